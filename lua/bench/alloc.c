@@ -0,0 +1,105 @@
+/*
+** $Id: alloc.c $
+** Allocators: states from 'luaL_newstate' (C library malloc),
+** 'luaL_newpoolstate' and 'luaL_newarenastate' running string, table
+** and closure churn, and closing states with many live objects
+** See Copyright Notice in lua.h
+**
+** Build it with the Lua library, e.g., from this directory,
+**   cc -O2 -I.. -o alloc alloc.c ../l*.c -lm
+** and run it as 'alloc [n]' (n operations in each test, 5M by default).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const struct {
+  const char *name;
+  const char *code;
+} tests[] = {
+  {"strings", "local N = ... local t = {}\n"
+              "for i = 1, N do t[i % 1000 + 1] = 'key' .. i end"},
+  {"tables", "local N = ... local t = {}\n"
+             "for i = 1, N do t[i % 1000 + 1] = {i, x = i} end"},
+  {"growing tables", "local N = ...\n"
+                     "for i = 1, N // 100 do\n"
+                     "  local t = {}\n"
+                     "  for j = 1, 100 do t[j] = j; t['k' .. j % 10] = j end\n"
+                     "end"},
+  {"closures", "local N = ... local t = {}\n"
+               "for i = 1, N do t[i % 1000 + 1] = function () return i end end"},
+  {"live objects", "local N = ... t = {}\n"  /* (left for 'lua_close') */
+                   "for i = 1, N // 10 do t[i] = {tostring(i)} end"},
+};
+
+#define NTESTS	(sizeof(tests) / sizeof(tests[0]))
+
+
+static const struct {
+  const char *name;
+  lua_State *(*newstate) (void);
+} allocs[] = {
+  {"malloc", luaL_newstate},
+  {"pool", luaL_newpoolstate},
+  {"arena", luaL_newarenastate},
+};
+
+#define NALLOCS	(sizeof(allocs) / sizeof(allocs[0]))
+
+
+static double seconds (clock_t t0) {
+  return (double)(clock() - t0) / CLOCKS_PER_SEC;
+}
+
+
+int main (int argc, char **argv) {
+  lua_Integer n = (argc > 1) ? strtol(argv[1], NULL, 10) : 5000000;
+  size_t a, i;
+  printf("%-8s", "");
+  for (i = 0; i < NTESTS; i++)
+    printf(" %14s", tests[i].name);
+  printf(" %14s\n", "close");
+  for (a = 0; a < NALLOCS; a++) {
+    lua_State *L = allocs[a].newstate();
+    luaL_PoolStats s;
+    int havestats;
+    clock_t t0;
+    if (L == NULL) {
+      fprintf(stderr, "cannot create state\n");
+      return 1;
+    }
+    luaL_openlibs(L);
+    printf("%-8s", allocs[a].name);
+    for (i = 0; i < NTESTS; i++) {
+      lua_gc(L, LUA_GCCOLLECT, 0);
+      t0 = clock();
+      if (luaL_loadstring(L, tests[i].code) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+      }
+      lua_pushinteger(L, n);
+      if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+      }
+      printf(" %12.3fs", seconds(t0));
+      fflush(stdout);
+    }
+    havestats = luaL_poolstats(L, &s);
+    t0 = clock();
+    lua_close(L);
+    printf(" %12.3fs\n", seconds(t0));
+    if (havestats)
+      printf("  (small blocks: %zu KB in %zu KB of slabs, %zu allocated; "
+             "large: %zu KB, %zu allocated)\n",
+             s.smallbytes / 1024, s.slabbytes / 1024, s.nsmall,
+             s.largebytes / 1024, s.nlarge);
+  }
+  return 0;
+}
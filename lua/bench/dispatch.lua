@@ -0,0 +1,98 @@
+-- $Id: dispatch.lua $
+-- Interpreter dispatch: short loops over a common mix of instructions
+-- (usage: lua dispatch.lua [runs]). To compare dispatch methods, run it
+-- with an interpreter built as usual and one built with
+-- -DLUA_USE_JUMPTABLE=0, both without LUA_USE_JIT. Each line shows the
+-- best of 'runs' times.
+
+local runs = tonumber(arg and arg[1]) or 5
+
+
+local function fib (n)
+  if n < 2 then return n end
+  return fib(n - 1) + fib(n - 2)
+end
+
+
+local tests = {}
+
+tests[#tests + 1] = {"calls (fib 30)", function ()
+  return fib(30)
+end}
+
+tests[#tests + 1] = {"integer arithmetic", function ()
+  local a, b = 0, 1
+  for i = 1, 20000000 do
+    a = (a + i * 3 - b) % 1000003
+    b = b ~ (i & 0xff)
+  end
+  return a + b
+end}
+
+tests[#tests + 1] = {"float arithmetic", function ()
+  local x, y = 0.0, 1.5
+  for i = 1, 10000000 do
+    x = x * 0.5 + y / 3.0 - i
+    y = -y
+  end
+  return x
+end}
+
+tests[#tests + 1] = {"comparisons and branches", function ()
+  local n, i = 0, 0
+  while i < 20000000 do
+    if i % 3 == 0 then n = n + 1
+    elseif i < 100 or i > 1000 then n = n - 1
+    else n = n + 2 end
+    i = i + 1
+  end
+  return n
+end}
+
+tests[#tests + 1] = {"locals and upvalues", function ()
+  local c = 0
+  local function inc (d) c = c + d; return c end
+  for i = 1, 10000000 do inc(1); inc(-1); inc(i & 1) end
+  return c
+end}
+
+tests[#tests + 1] = {"fields and methods", function ()
+  local P = {}
+  P.__index = P
+  function P:move (dx, dy) self.x = self.x + dx; self.y = self.y + dy end
+  local p = setmetatable({x = 0, y = 0}, P)
+  for i = 1, 10000000 do p:move(1, -1) end
+  return p.x + p.y
+end}
+
+tests[#tests + 1] = {"array reads and writes", function ()
+  local t = {}
+  for i = 1, 1000 do t[i] = i end
+  local s = 0
+  for r = 1, 10000 do
+    for i = 1, 1000 do s = s + t[i]; t[i] = s & 0xff end
+  end
+  return s
+end}
+
+tests[#tests + 1] = {"globals and library calls", function ()
+  local s = 0
+  for i = 1, 5000000 do s = s + math.abs(-i) + math.max(i, 3) end
+  return s
+end}
+
+
+print(string.format("%-28s %10s", "test", "seconds"))
+local total = 0
+for _, t in ipairs(tests) do
+  local best = math.huge
+  for r = 1, runs do
+    local t0 = os.clock()
+    t[2]()
+    local e = os.clock() - t0
+    if e < best then best = e end
+  end
+  total = total + best
+  print(string.format("%-28s %10.3f", t[1], best))
+end
+print(string.format("%-28s %10.3f", "total", total))
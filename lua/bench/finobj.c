@@ -0,0 +1,131 @@
+/*
+** $Id: finobj.c $
+** Objects with finalizers: bound objects (full userdata whose metatable
+** has a C '__gc', as C++ bindings make them), finalizers given to objects
+** created earlier, and the atomic pause with such objects
+** See Copyright Notice in lua.h
+**
+** Build it with the Lua library, e.g., from this directory,
+**   cc -O2 -I.. -o finobj finobj.c ../l*.c -lm
+** and run it as 'finobj [n]' (n objects, 10M by default).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+typedef struct Obj {
+  lua_Integer id;
+  double x, y;
+} Obj;
+
+
+static lua_Integer finalized = 0;
+
+
+static int obj_gc (lua_State *L) {
+  Obj *o = (Obj *)luaL_checkudata(L, 1, "Obj");
+  o->id = -1;
+  finalized++;
+  return 0;
+}
+
+
+/* newobj(id): a new bound object */
+static int obj_new (lua_State *L) {
+  Obj *o = (Obj *)lua_newuserdata(L, sizeof(Obj));
+  o->id = luaL_optinteger(L, 1, 0);
+  o->x = o->y = 0;
+  luaL_setmetatable(L, "Obj");
+  return 1;
+}
+
+
+/* finalized(): number of objects finalized so far */
+static int obj_finalized (lua_State *L) {
+  lua_pushinteger(L, finalized);
+  return 1;
+}
+
+
+static const char *const bench =
+  "local N = ...\n"
+  "local function time (what, f)\n"
+  "  collectgarbage(); collectgarbage()\n"
+  "  local t0 = os.clock()\n"
+  "  local n = f()\n"
+  "  print(string.format('%-44s %8.3f s  %6.1f ns/object', what,\n"
+  "                      os.clock() - t0, (os.clock() - t0) / n * 1e9))\n"
+  "end\n"
+  "time(string.format('create and drop %d bound objects', N), function ()\n"
+  "  for i = 1, N do local o = newobj(i) end\n"
+  "  return N\n"
+  "end)\n"
+  "time(string.format('create and keep %d bound objects', N // 10),\n"
+  "     function ()\n"
+  "  local t = {}\n"
+  "  for i = 1, N // 10 do t[i] = newobj(i) end\n"
+  "  return N // 10\n"
+  "end)\n"
+  "time(string.format('__gc for %d tables created earlier', N // 10),\n"
+  "     function ()\n"
+  "  local mt = {__gc = function () end}\n"
+  "  local t = {}\n"
+  "  for i = 1, N // 10 do t[i] = {} end\n"
+  "  for i = 1, N // 10 do setmetatable(t[i], mt) end\n"
+  "  return N // 10\n"
+  "end)\n"
+  "collectgarbage(); collectgarbage()\n"
+  "assert(finalized() >= N + N // 10)\n"
+  /* atomic pause: dead objects with finalizers given late, in a big heap */
+  "local function atomic (late)\n"
+  "  collectgarbage()\n"
+  "  collectgarbage('stop')\n"  /* (full collections move them first) */
+  "  local objs = {}\n"
+  "  for i = 1, late do objs[i] = {} end\n"
+  "  local heap = {}\n"
+  "  for i = 1, N // 4 do heap[i] = {} end\n"
+  "  local mt = {__gc = function () end}\n"
+  "  for i = 1, late do setmetatable(objs[i], mt) end\n"
+  "  objs = nil\n"
+  "  collectgarbage('setstats', 1)\n"
+  "  repeat until collectgarbage('step')\n"  /* the cycle where they die */
+  "  collectgarbage('step')\n"  /* start another one, to see its stats */
+  "  local us = collectgarbage('stats').atomic\n"
+  "  collectgarbage('setstats', 0)\n"
+  "  collectgarbage('restart')\n"
+  "  return us\n"
+  "end\n"
+  "print(string.format('atomic phase, %d live tables:', N // 4))\n"
+  "for _, late in ipairs{0, 1000, 100000} do\n"
+  "  print(string.format('  %6d dead objects given __gc late %8d us',\n"
+  "                      late, atomic(late)))\n"
+  "end\n";
+
+
+int main (int argc, char **argv) {
+  lua_Integer n = (argc > 1) ? strtol(argv[1], NULL, 10) : 10000000;
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  luaL_newmetatable(L, "Obj");
+  lua_pushcfunction(L, obj_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  lua_register(L, "newobj", obj_new);
+  lua_register(L, "finalized", obj_finalized);
+  if (luaL_loadstring(L, bench) != LUA_OK) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  lua_pushinteger(L, n);
+  if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,54 @@
+-- $Id: growth.lua $
+-- Latency of insertions while tables grow: fills a table with 'n' keys
+-- in batches of 'b' insertions and shows percentiles of the times of
+-- the batches (usage: lua growth.lua [n [b]]; run it with both
+-- interpreters to compare). Rehashes show up in the maximum; the cost
+-- they spread over other insertions shows up in the percentiles.
+
+local n = tonumber(arg and arg[1]) or 4000000
+local b = tonumber(arg and arg[2]) or 1000
+
+local clock = os.clock
+
+
+-- fill a table with keys 'key(1)' to 'key(n)'; return batch times in ms
+local function fill (key)
+  local t = {}
+  local times = {}
+  local i = 1
+  while i <= n do
+    local lim = math.min(i + b - 1, n)
+    local t0 = clock()
+    for j = i, lim do t[key(j)] = j end
+    times[#times + 1] = (clock() - t0) * 1e3
+    i = lim + 1
+  end
+  return times
+end
+
+
+local function percentile (times, p)
+  return times[math.max(1, math.ceil(#times * p / 100))]
+end
+
+
+local tests = {
+  {"integer keys", function (i) return i * 0x9e3779b1 end},
+  {"float keys", function (i) return i + 0.5 end},
+  {"string keys", function (i) return "k" .. i end},
+}
+
+
+print(string.format("%d keys, batches of %d insertions (ms)", n, b))
+print(string.format("%-16s %8s %8s %8s %8s %9s", "test", "p50", "p99",
+                    "p99.9", "max", "total"))
+for _, t in ipairs(tests) do
+  collectgarbage()
+  local times = fill(t[2])
+  local total = 0
+  for i = 1, #times do total = total + times[i] end
+  table.sort(times)
+  print(string.format("%-16s %8.3f %8.3f %8.3f %8.2f %9.1f", t[1],
+        percentile(times, 50), percentile(times, 99),
+        percentile(times, 99.9), times[#times], total))
+end
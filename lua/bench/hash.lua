@@ -0,0 +1,79 @@
+-- $Id: hash.lua $
+-- Hash part: insertion, lookup, iteration and churn with string and
+-- integer keys (usage: lua hash.lua [largest size]; sizes are 1K, 1M and
+-- 10M keys, up to the given one). Times are in nanoseconds per key, and
+-- small tables repeat each operation to run about as long as large ones.
+
+local maxn = tonumber(arg and arg[1]) or 10000000
+local OPS = 10000000  -- operations (at least) in each measurement
+
+
+local function strkeys (n)
+  local ks = {}
+  for i = 1, n do ks[i] = "key" .. i end
+  return ks
+end
+
+
+-- scattered (so not in the array part) distinct integers
+local function intkeys (n)
+  local ks = {}
+  for i = 1, n do ks[i] = (i * 0x9e3779b1) & 0xffffffff end
+  return ks
+end
+
+
+local function run (kind, ks)
+  local n = #ks
+  local reps = math.max(1, OPS // n)
+  local ins, look, iter
+  local t
+  local t0 = os.clock()
+  for r = 1, reps do
+    t = {}
+    for i = 1, n do t[ks[i]] = i end
+  end
+  ins = os.clock() - t0
+  local s = 0
+  t0 = os.clock()
+  for r = 1, reps do
+    for i = 1, n do s = s + t[ks[i]] end
+  end
+  look = os.clock() - t0
+  t0 = os.clock()
+  for r = 1, reps do
+    for k, v in pairs(t) do s = s + v end
+  end
+  iter = os.clock() - t0
+  local f = 1e9 / (n * reps)
+  print(string.format("%-4s %9d %9.1f %9.1f %9.1f", kind, n, ins * f,
+                      look * f, iter * f))
+end
+
+
+print(string.format("%-4s %9s %9s %9s %9s", "keys", "n", "insert",
+                    "lookup", "next"))
+for _, n in ipairs{1000, 1000000, 10000000} do
+  if n <= maxn then
+    run("str", strkeys(n))
+    collectgarbage()
+    run("int", intkeys(n))
+    collectgarbage()
+  end
+end
+
+
+-- churn: a table of constant size where keys come and go
+do
+  local t = {}
+  for i = 1, 7000 do t["k" .. i] = i end
+  local ks = {}
+  for i = 1, 1024 do ks[i] = "x" .. i end
+  local t0 = os.clock()
+  for i = 1, 2000000 do
+    local k = ks[(i & 1023) + 1]
+    t[k] = i; t[k] = nil
+  end
+  print(string.format("churn (7000 keys, 2M insert/remove): %.1f ns/pair",
+                      (os.clock() - t0) / 2000000 * 1e9))
+end
@@ -0,0 +1,111 @@
+-- $Id: jit.lua $
+-- Native compiler: loops made of the instructions it compiles inline or
+-- with helpers, and some that leave native code (usage: lua jit.lua
+-- [runs]). To measure the compiler, run it with an interpreter built
+-- with LUA_USE_JIT and one built without it. Each line shows the best
+-- of 'runs' times.
+
+local runs = tonumber(arg and arg[1]) or 5
+
+
+local tests = {}
+
+tests[#tests + 1] = {"integer arithmetic", function ()
+  local a, b = 0, 1
+  for i = 1, 20000000 do
+    a = (a + i * 3 - b) & 0xfffff
+    b = b ~ (i & 0xff)
+  end
+  return a + b
+end}
+
+tests[#tests + 1] = {"float arithmetic", function ()
+  local x, y = 0.0, 1.5
+  for i = 1, 20000000 do
+    x = x * 0.5 + y / 3.0 - i
+    y = -y
+  end
+  return x
+end}
+
+tests[#tests + 1] = {"comparisons and branches", function ()
+  local n, i = 0, 0
+  while i < 20000000 do
+    if i < 100 or i > 1000 then n = n - 1
+    elseif i == 500 then n = n + 5
+    else n = n + 2 end
+    i = i + 1
+  end
+  return n
+end}
+
+tests[#tests + 1] = {"packed array reads and writes", function ()
+  local t = {}
+  for i = 1, 1000 do t[i] = i end
+  local s = 0
+  for r = 1, 10000 do
+    for i = 1, 1000 do s = s + t[i]; t[i] = s & 0xff end
+  end
+  return s
+end}
+
+tests[#tests + 1] = {"float array (mul-add)", function ()
+  local x, y = {}, {}
+  for i = 1, 1000 do x[i] = i * 0.5; y[i] = 1.0 end
+  for r = 1, 10000 do
+    for i = 1, 1000 do y[i] = y[i] * 0.999 + x[i] end
+  end
+  return y[1000]
+end}
+
+tests[#tests + 1] = {"fields", function ()
+  local p = {x = 0, y = 0, dx = 1, dy = -1}
+  for i = 1, 10000000 do
+    p.x = p.x + p.dx
+    p.y = p.y + p.dy
+  end
+  return p.x + p.y
+end}
+
+tests[#tests + 1] = {"upvalues", function ()
+  local c = 0
+  local function run (n)
+    for i = 1, n do c = c + (i & 3) end
+  end
+  run(20000000)
+  return c
+end}
+
+tests[#tests + 1] = {"arrays changing type (exits)", function ()
+  local s = 0
+  for r = 1, 2000 do
+    local t = {}
+    for i = 1, 1000 do t[i] = i end  -- packed integers
+    t[500] = 0.5  -- unpacked by the interpreter
+    for i = 1, 1000 do s = s + t[i] end
+  end
+  return s
+end}
+
+tests[#tests + 1] = {"calls (exits)", function ()
+  local function add (a, b) return a + b end
+  local s = 0
+  for i = 1, 5000000 do s = add(s, i & 7) end
+  return s
+end}
+
+
+print(string.format("%-32s %10s", "test", "seconds"))
+local total = 0
+for _, t in ipairs(tests) do
+  local best = math.huge
+  for r = 1, runs do
+    local t0 = os.clock()
+    t[2]()
+    local e = os.clock() - t0
+    if e < best then best = e end
+  end
+  total = total + best
+  print(string.format("%-32s %10.3f", t[1], best))
+end
+print(string.format("%-32s %10.3f", "total", total))
@@ -0,0 +1,72 @@
+-- $Id: records.lua $
+-- Small records: time and memory of a million tables with 2 to 6 fields
+-- (usage: lua records.lua [n [fields]]; run it with both interpreters to
+-- compare). The collector does not count the overhead of the allocation
+-- function, so, with 'fields', only that kind of record is built and the
+-- growth of the resident set (read from /proc, where there is one) is
+-- shown too.
+
+local n = tonumber(arg and arg[1]) or 1000000
+local only = tonumber(arg and arg[2])
+
+local function kb ()
+  collectgarbage(); collectgarbage()
+  return collectgarbage("count")
+end
+
+-- resident set in KB (nil if unknown)
+local function rss ()
+  local f = io.open("/proc/self/status")
+  if not f then return nil end
+  local s = f:read("a")
+  f:close()
+  return tonumber(string.match(s, "VmRSS:%s*(%d+)"))
+end
+
+
+local makers = {
+  [2] = function (i) return {x = i, y = i} end,
+  [3] = function (i) return {x = i, y = i, z = i} end,
+  [4] = function (i) return {x = i, y = i, w = i, h = i} end,
+  [6] = function (i) return {id = i, name = "n", x = i, y = i, w = 1, h = 1} end,
+}
+
+print(string.format("%d records", n))
+print("fields   create(s)   read(s)   bytes/record   rss/record")
+for _, fields in ipairs{2, 3, 4, 6} do
+  if not only or only == fields then
+    local make = makers[fields]
+    local t = {}
+    for i = 1, n do t[i] = false end  -- array part out of the count
+    local base, rbase = kb(), rss()
+    local t0 = os.clock()
+    for i = 1, n do t[i] = make(i) end
+    local create = os.clock() - t0
+    local bytes = (kb() - base) * 1024 / n
+    local rbytes = (only and rbase) and (rss() - rbase) * 1024 / n
+    t0 = os.clock()
+    local s = 0
+    for r = 1, 5 do
+      for i = 1, n do local o = t[i]; s = s + o.x + o.y end
+    end
+    local read = os.clock() - t0
+    print(string.format("%6d   %9.3f   %7.3f   %12.1f   %10s", fields,
+                        create, read, bytes,
+                        rbytes and string.format("%.1f", rbytes) or "-"))
+    t = nil
+  end
+end
+
+-- records that grow past the room in their block (built field by field)
+if not only then
+  local t = {}
+  local t0 = os.clock()
+  for i = 1, n // 4 do
+    local o = {}
+    o.a = i; o.b = i; o.c = i; o.d = i; o.e = i; o.f = i; o.g = i; o.h = i
+    o.i = i; o.j = i
+    t[i] = o
+  end
+  print(string.format("growing to 10 fields (%d records): %.3f s", n // 4,
+                      os.clock() - t0))
+end
@@ -20,7 +20,9 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
+#include "lmemprof.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -595,7 +597,7 @@ static int auxgetstr (lua_State *L, const TValue *t, const char *k) {
   else {
     setsvalue2s(L, L->top, str);
     api_incr_top(L);
-    luaV_finishget(L, t, L->top - 1, L->top - 1, slot);
+    luaV_finishget(L, t, L->top - 1, L->top - 1, slot, NULL);
   }
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -637,7 +639,7 @@ LUA_API int lua_geti (lua_State *L, int idx, lua_Integer n) {
   else {
     setivalue(L->top, n);
     api_incr_top(L);
-    luaV_finishget(L, t, L->top - 1, L->top - 1, slot);
+    luaV_finishget(L, t, L->top - 1, L->top - 1, slot, NULL);
   }
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -684,7 +686,7 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
 LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   Table *t;
   lua_lock(L);
-  t = luaH_new(L);
+  t = luaH_newsized(L, nrec);
   sethvalue(L, L->top, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
@@ -744,6 +746,8 @@ static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
   const TValue *slot;
   TString *str = luaS_new(L, k);
   api_checknelems(L, 1);
+  if (iswatched(str))  /* key of hoisted lookups? */
+    G(L)->hoistepoch++;
   if (luaV_fastset(L, t, str, slot, luaH_getstr, L->top - 1))
     L->top--;  /* pop value */
   else {
@@ -805,10 +809,11 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   api_checknelems(L, 2);
   o = index2addr(L, idx);
   api_check(L, ttistable(o), "table expected");
+  luaV_checkwatch(L, L->top - 2);
   slot = luaH_set(L, hvalue(o), L->top - 2);
-  setobj2t(L, slot, L->top - 1);
+  luaH_setnewslot(L, hvalue(o), slot, L->top - 1);
   invalidateTMcache(hvalue(o));
-  luaC_barrierback(L, hvalue(o), L->top-1);
+  luaC_barrierslot(L, hvalue(o), slot, L->top-1);
   L->top -= 2;
   lua_unlock(L);
 }
@@ -836,8 +841,8 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   api_check(L, ttistable(o), "table expected");
   setpvalue(&k, cast(void *, p));
   slot = luaH_set(L, hvalue(o), &k);
-  setobj2t(L, slot, L->top - 1);
-  luaC_barrierback(L, hvalue(o), L->top - 1);
+  luaH_setslot(L, hvalue(o), slot, L->top - 1);
+  luaC_barrierslot(L, hvalue(o), slot, L->top - 1);
   L->top--;
   lua_unlock(L);
 }
@@ -858,6 +863,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   switch (ttnov(obj)) {
     case LUA_TTABLE: {
       hvalue(obj)->metatable = mt;
+      G(L)->hoistepoch++;  /* may change results of hoisted lookups */
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
         luaC_checkfinalizer(L, gcvalue(obj), mt);
@@ -1079,8 +1085,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
-        res = 1;  /* signal it */
+      if (debt > 0 && (g->gcstate == GCSpause || isgenerational(g)))
+        res = 1;  /* signal end of cycle (every step in generational mode) */
       break;
     }
     case LUA_GCSETPAUSE: {
@@ -1094,10 +1100,164 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCSETMAJORINC: {
+      res = g->gcmajorinc;
+      g->gcmajorinc = data;
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: {  /* change collector to generational mode */
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      if (data != 0) g->gcminorinc = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {  /* change collector to incremental mode */
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, KGC_NORMAL);
+      break;
+    }
+    case LUA_GCSETSTEPUS: {
+      res = g->gcstepus;
+      g->gcstepus = (data > 0) ? data : 0;
+      break;
+    }
+    case LUA_GCSTEPUS: {  /* run the collector for 'data' microseconds */
+      res = luaC_steptime(L, (data > 0) ? data : 1);
+      break;
+    }
+    case LUA_GCSETSTATS: {  /* turn statistics on or off */
+      res = (g->gcstats != NULL);
+      luaC_setstats(L, data);
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set a memory limit and return the previous one. Above the soft limit
+** the collector runs a step at each check, as in an emergency; above
+** the hard limit, allocations that still do not fit after an emergency
+** collection raise a memory error.
+*/
+LUA_API size_t lua_setmemlimit (lua_State *L, int what, size_t limit) {
+  size_t res;
+  api_check(L, what == LUA_MEMSOFT || what == LUA_MEMHARD, "invalid limit");
+  lua_lock(L);
+  res = luaM_setlimit(L, what, limit);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Set the function called when the memory in use crosses a limit: the
+** soft one whenever the collector is pushed to run a step, the hard one
+** before a memory error. It runs inside an allocation, so it must not
+** call the API; to let the host raise (or drop) the limit, it returns
+** the limit to use from then on.
+*/
+LUA_API void lua_setmemlimitf (lua_State *L, lua_MemLimit f, void *ud) {
+  lua_lock(L);
+  G(L)->memlimitf = f;
+  G(L)->memlimitud = ud;
+  lua_unlock(L);
+}
+
+
+/*
+** Get the statistics of the last finished collection cycle; returns 0
+** (and leaves 's' untouched) when they are off.
+*/
+LUA_API int lua_gcstats (lua_State *L, lua_GCStats *s) {
+  GCStats *st;
+  lua_lock(L);
+  st = G(L)->gcstats;
+  if (st != NULL)
+    *s = st->last;
+  lua_unlock(L);
+  return (st != NULL);
+}
+
+
+LUA_API int lua_compileropts (lua_State *L, int opts) {
+  int res;
+  lua_lock(L);
+  res = G(L)->copts;
+  G(L)->copts = cast_byte(opts);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Heap profiler control: a positive 'rate' starts the profiler (or
+** changes its mean sampling interval, in bytes), 0 stops it and
+** discards its data, and a negative one changes nothing. Returns the
+** previous rate (0 if the profiler was off).
+*/
+LUA_API int lua_heapprofile (lua_State *L, int rate) {
+  int res;
+  lua_lock(L);
+  res = luaM_setprofile(L, rate);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Write the profile as folded stacks ("f1;f2;f3 bytes"), one line per
+** site with bytes of kind 'what' (LUA_PROF*). Returns the status of
+** the writer, or -1 if the profiler is off.
+*/
+LUA_API int lua_heapdump (lua_State *L, int what, lua_Writer writer,
+                                                  void *data) {
+  int status;
+  api_check(L, LUA_PROFLIVE <= what && what <= LUA_PROFFREED,
+               "invalid option");
+  lua_lock(L);
+  status = luaM_profdump(L, what, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Native compiler control. Stopping the compiler also keeps already
+** compiled functions in the interpreter; without a native compiler
+** (see ljit.h), it is never running.
+*/
+LUA_API int lua_jit (lua_State *L, int what, int data) {
+  int res = 0;
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  switch (what) {
+    case LUA_JITSTOP: {
+      g->jitrunning = 0;
+      break;
+    }
+    case LUA_JITRESTART: {
+      g->jitrunning = LUAJ_NATIVE;
+      break;
+    }
+    case LUA_JITISRUNNING: {
+      res = g->jitrunning;
+      break;
+    }
+    case LUA_JITSETHOT: {
+      res = g->jithot;
+      if (data < 1) data = 1;
+      g->jithot = data;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1137,6 +1297,45 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+LUA_API void lua_reservetable (lua_State *L, int idx, int narray, int nrec) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  api_check(L, narray >= 0 && nrec >= 0, "negative size");
+  luaH_reserve(L, hvalue(t), narray, nrec);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_clear(L, hvalue(t));
+  G(L)->hoistepoch++;  /* fields of hoisted lookups may be gone */
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_clonetable (lua_State *L, int idx) {
+  StkId o;
+  Table *t, *c;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  t = hvalue(o);
+  c = luaH_newsized(L, isdummy(t) ? 0 : sizenode(t));
+  sethvalue(L, L->top, c);
+  api_incr_top(L);
+  luaH_copy(L, c, t);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_concat (lua_State *L, int n) {
   lua_lock(L);
   api_checknelems(L, n);
@@ -1177,6 +1376,20 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
   G(L)->ud = ud;
   G(L)->frealloc = f;
+  G(L)->bulkfree = 0;
+  lua_unlock(L);
+}
+
+
+/*
+** Tell whether the allocation function releases all blocks still in use
+** when 'lua_close' frees the main block of the state. If so,
+** 'lua_close' runs pending finalizers but does not free each object
+** (so it does not call 'luai_userstatefree' for other threads either).
+*/
+LUA_API void lua_setbulkfree (lua_State *L, int on) {
+  lua_lock(L);
+  G(L)->bulkfree = (on != 0);
   lua_unlock(L);
 }
 
@@ -1245,6 +1458,8 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   name = aux_upvalue(fi, n, &val, &owner, &uv);
   if (name) {
     L->top--;
+    if (ttistable(val))  /* may hold tables of hoisted lookups */
+      G(L)->hoistepoch++;
     setobj(L, val, L->top);
     if (owner) { luaC_barrier(L, owner, L->top); }
     else if (uv) { luaC_upvalbarrier(L, uv); }
@@ -1290,6 +1505,7 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
   UpVal **up1 = getupvalref(L, fidx1, n1, &f1);
   UpVal **up2 = getupvalref(L, fidx2, n2, NULL);
   luaC_upvdeccount(L, *up1);
+  G(L)->hoistepoch++;  /* 'f1' may have hoisted lookups over '*up1' */
   *up1 = *up2;
   (*up1)->refcount++;
   if (upisopen(*up1)) (*up1)->u.open.touched = 1;
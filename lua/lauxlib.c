@@ -1030,6 +1030,333 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+/*
+** Blocks of up to LUAL_POOLMAX bytes (strings, tables, closures,
+** upvalues, small vectors) are carved from slabs, with one size class
+** for each POOLGRAIN bytes, and are recycled through a free list for
+** each class. Larger blocks go to 'realloc'. Lua always gives the size
+** of a block it frees or resizes, so blocks need no header. Slabs are
+** released only when the pool has no blocks left, which happens when
+** the state closes: its main block is the first one allocated and the
+** last one freed.
+**
+** Large blocks are linked in a list (through a header), so that an
+** arena pool can release all blocks still in use when its main block
+** is freed. Its state is marked with 'lua_setbulkfree', so that
+** 'lua_close' only runs finalizers and frees the main block.
+**
+** Shrinking a block never fails: when there is no memory for a block
+** of the new class, the old one is kept (a large one shrunk in place)
+** and later serves its new class. (Such a large block stays in the
+** list, so that the pool frees it when it is deleted.)
+*/
+
+#if !defined(LUAL_POOLMAX)
+#define LUAL_POOLMAX	256
+#endif
+
+#if !defined(LUAL_POOLSLAB)
+#define LUAL_POOLSLAB	(32 * 1024)
+#endif
+
+/* granularity of size classes (also the alignment of blocks) */
+#define POOLGRAIN	16
+
+#define NPOOLCLASSES	(LUAL_POOLMAX / POOLGRAIN)
+
+/* size class of a small block with 'sz' (> 0) bytes */
+#define poolclass(sz)	(((sz) - 1) / POOLGRAIN)
+
+#define issmall(sz)	((sz) <= LUAL_POOLMAX)
+
+
+/* header of large blocks */
+typedef struct Large {
+  struct Large *prev, *next;
+} Large;
+
+/* size of the header, rounded to keep the alignment of blocks */
+#define LARGEHDR  \
+	(((sizeof(Large) + POOLGRAIN - 1) / POOLGRAIN) * POOLGRAIN)
+
+#define tolarge(b)	((Large *)((char *)(b) - LARGEHDR))
+#define fromlarge(l)	((void *)((char *)(l) + LARGEHDR))
+
+
+typedef struct Pool {
+  void *free[NPOOLCLASSES];  /* lists of free blocks of each class */
+  char *top[NPOOLCLASSES];  /* unused part of last slab of each class */
+  size_t left[NPOOLCLASSES];  /* number of blocks left at 'top' */
+  void *slabs;  /* list of all slabs (linked by their first word) */
+  size_t nblocks;  /* number of blocks in use */
+  void *main;  /* main block of the state */
+  Large large;  /* sentinel of the list of large blocks */
+  int arena;  /* true if freeing 'main' releases all blocks */
+  int held;  /* true while 'luaL_newpoolstate' creates the state */
+  luaL_PoolStats stats;
+} Pool;
+
+
+static void linklarge (Pool *p, Large *l) {
+  l->prev = &p->large;
+  l->next = p->large.next;
+  l->next->prev = l;
+  p->large.next = l;
+}
+
+
+static void unlinklarge (Large *l) {
+  l->prev->next = l->next;
+  l->next->prev = l->prev;
+}
+
+
+static void *largealloc (Pool *p, size_t size) {
+  Large *l;
+  if ((l = (Large *)malloc(LARGEHDR + size)) == NULL)
+    return NULL;
+  linklarge(p, l);
+  return fromlarge(l);
+}
+
+
+static void largefree (void *b) {
+  unlinklarge(tolarge(b));
+  free(tolarge(b));
+}
+
+
+static void *largerealloc (Pool *p, void *b, size_t size) {
+  Large *l;
+  unlinklarge(tolarge(b));
+  l = (Large *)realloc(tolarge(b), LARGEHDR + size);
+  if (l == NULL) {  /* keep the old block */
+    linklarge(p, tolarge(b));
+    return NULL;
+  }
+  linklarge(p, l);
+  return fromlarge(l);
+}
+
+
+static void *newslab (Pool *p, int c) {
+  size_t size = (c + 1) * POOLGRAIN;
+  void **s = (void **)malloc(LUAL_POOLSLAB);
+  if (s == NULL) return NULL;
+  *s = p->slabs;  /* link it in the list of slabs */
+  p->slabs = s;
+  p->top[c] = (char *)s + POOLGRAIN;  /* first block after the link */
+  p->left[c] = (LUAL_POOLSLAB - POOLGRAIN) / size;
+  p->stats.slabbytes += LUAL_POOLSLAB;
+  return s;
+}
+
+
+static void *blockalloc (Pool *p, size_t size) {
+  void *b;
+  if (issmall(size)) {
+    int c = poolclass(size);
+    if ((b = p->free[c]) != NULL)
+      p->free[c] = *(void **)b;  /* reuse a free block */
+    else if (p->left[c] > 0 || newslab(p, c) != NULL) {
+      b = p->top[c];  /* carve block from current slab */
+      p->top[c] += (c + 1) * POOLGRAIN;
+      p->left[c]--;
+    }
+    else return NULL;  /* no memory for a new slab */
+    p->stats.smallbytes += size;
+    p->stats.nsmall++;
+  }
+  else {
+    if ((b = largealloc(p, size)) == NULL) return NULL;
+    p->stats.largebytes += size;
+    p->stats.nlarge++;
+  }
+  p->nblocks++;
+  return b;
+}
+
+
+static void blockfree (Pool *p, void *b, size_t size) {
+  if (issmall(size)) {
+    int c = poolclass(size);
+    *(void **)b = p->free[c];
+    p->free[c] = b;
+    p->stats.smallbytes -= size;
+  }
+  else {
+    largefree(b);
+    p->stats.largebytes -= size;
+  }
+  p->nblocks--;
+}
+
+
+/*
+** Free all blocks still in use (the large ones; small ones go with
+** their slabs)
+*/
+static void releaseall (Pool *p) {
+  Large *l = p->large.next;
+  while (l != &p->large) {
+    Large *next = l->next;
+    free(l);
+    l = next;
+  }
+  p->large.prev = p->large.next = &p->large;
+  p->nblocks = 0;
+}
+
+
+static void pooldelete (Pool *p) {
+  void *s = p->slabs;
+  releaseall(p);  /* large blocks kept for small ones */
+  while (s != NULL) {
+    void *next = *(void **)s;
+    free(s);
+    s = next;
+  }
+  free(p);
+}
+
+
+/*
+** Keep block 'b' as a block of the smaller size 'nsize' (when there is
+** no memory for a new one). A small block goes to the free list of its
+** new class when freed, with some bytes to spare; a large one is
+** shrunk to the size of that class.
+*/
+static void *keepblock (Pool *p, void *b, size_t osize, size_t nsize) {
+  if (issmall(osize))
+    p->stats.smallbytes -= osize;
+  else {
+    void *nb = largerealloc(p, b, (poolclass(nsize) + 1) * POOLGRAIN);
+    if (nb != NULL) b = nb;
+    p->stats.largebytes -= osize;
+  }
+  p->stats.smallbytes += nsize;
+  return b;
+}
+
+
+static void *l_poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nb;
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      blockfree(p, ptr, osize);
+      if (ptr == p->main && p->arena)  /* closing an arena state? */
+        releaseall(p);
+      if (p->nblocks == 0 && !p->held) {  /* state is gone? */
+        pooldelete(p);
+        return NULL;
+      }
+    }
+    nb = NULL;
+  }
+  else if (ptr == NULL) {  /* 'osize' is the kind of object */
+    nb = blockalloc(p, nsize);
+    if (p->main == NULL)  /* first block is the main one */
+      p->main = nb;
+  }
+  else if (!issmall(osize) && !issmall(nsize)) {
+    if ((nb = largerealloc(p, ptr, nsize)) != NULL)
+      p->stats.largebytes += nsize - osize;
+    else if (nsize <= osize) {  /* keep the old block */
+      nb = ptr;
+      p->stats.largebytes += nsize - osize;
+    }
+  }
+  else if (issmall(osize) && issmall(nsize) &&
+           poolclass(osize) == poolclass(nsize)) {
+    nb = ptr;  /* block still fits */
+    p->stats.smallbytes += nsize - osize;
+  }
+  else if ((nb = blockalloc(p, nsize)) != NULL) {
+    memcpy(nb, ptr, (osize < nsize) ? osize : nsize);
+    blockfree(p, ptr, osize);
+  }
+  else if (nsize <= osize)  /* shrinking? */
+    nb = keepblock(p, ptr, osize, nsize);
+  return nb;
+}
+
+
+static lua_State *newpoolstate (int arena) {
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  int i;
+  if (p == NULL) return NULL;
+  for (i = 0; i < NPOOLCLASSES; i++) {
+    p->free[i] = NULL;
+    p->top[i] = NULL;
+    p->left[i] = 0;
+  }
+  p->slabs = NULL;
+  p->nblocks = 0;
+  p->main = NULL;
+  p->large.prev = p->large.next = &p->large;
+  p->arena = arena;
+  p->held = 1;  /* keep the pool while creating the state */
+  p->stats.smallbytes = p->stats.largebytes = p->stats.slabbytes = 0;
+  p->stats.nsmall = p->stats.nlarge = 0;
+  L = lua_newstate(l_poolalloc, p);
+  p->held = 0;
+  if (L == NULL)  /* state was not created? (all its blocks are free) */
+    pooldelete(p);
+  else {
+    lua_atpanic(L, &panic);
+    lua_setbulkfree(L, arena);
+  }
+  return L;
+}
+
+
+/*
+** Create a state whose allocations come from a new pool. The pool
+** is held until 'lua_newstate' returns, so that a failing
+** 'lua_newstate' (which frees all blocks) does not delete it.
+*/
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  return newpoolstate(0);
+}
+
+
+/*
+** Create a state whose allocations come from a new arena pool. Closing
+** it runs pending finalizers and then releases all its memory at once,
+** without freeing each object.
+*/
+LUALIB_API lua_State *luaL_newarenastate (void) {
+  return newpoolstate(1);
+}
+
+
+/*
+** Get the statistics of the pool of a state created by
+** 'luaL_newpoolstate'. Return false (leaving 's' untouched) if the
+** state uses another allocation function.
+*/
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *s) {
+  void *ud;
+  Pool *p;
+  if (lua_getallocf(L, &ud) != l_poolalloc)
+    return 0;
+  p = (Pool *)ud;
+  *s = p->stats;
+  return 1;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   const lua_Number *v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -175,6 +175,28 @@ LUALIB_API char *(luaL_buffinitsize) (lua_State *L, luaL_Buffer *B, size_t sz);
 
 
 
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+typedef struct luaL_PoolStats {
+  size_t smallbytes;  /* bytes in small (pooled) blocks in use */
+  size_t largebytes;  /* bytes in large blocks in use */
+  size_t slabbytes;  /* bytes held in slabs for small blocks */
+  size_t nsmall;  /* number of small blocks allocated so far */
+  size_t nlarge;  /* number of large blocks allocated so far */
+} luaL_PoolStats;
+
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API lua_State *(luaL_newarenastate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *s);
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** File handles for IO library
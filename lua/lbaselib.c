@@ -170,26 +170,82 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+/* "stats" is not a 'lua_gc' option */
+#define GCSTATS		(-1)
+
+
+/*
+** push a table with the statistics of the last collection cycle (or
+** nil, if statistics are off)
+*/
+static int gcstats (lua_State *L) {
+  lua_GCStats s;
+  int i;
+  if (!lua_gcstats(L, &s)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, s.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, s.propagate);
+  lua_setfield(L, -2, "propagate");
+  lua_pushinteger(L, s.atomic);
+  lua_setfield(L, -2, "atomic");
+  lua_pushinteger(L, s.sweep);
+  lua_setfield(L, -2, "sweep");
+  lua_pushinteger(L, s.finalizers);
+  lua_setfield(L, -2, "finalizers");
+  lua_pushinteger(L, s.traversed);
+  lua_setfield(L, -2, "traversed");
+  lua_pushinteger(L, s.ephemeronpasses);
+  lua_setfield(L, -2, "ephemeronpasses");
+  lua_createtable(L, 0, 5);  /* bytes freed, by type name */
+  for (i = LUA_TSTRING; i < LUA_NUMTAGS; i++) {
+    lua_pushinteger(L, s.freed[i]);
+    lua_setfield(L, -2, lua_typename(L, i));
+  }
+  lua_setfield(L, -2, "freed");
+  lua_createtable(L, LUA_GCSTATPAUSES, 0);  /* pause histogram */
+  for (i = 0; i < LUA_GCSTATPAUSES; i++) {
+    lua_pushinteger(L, s.pauses[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "pauses");
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "setmajorinc", "isrunning", "generational", "incremental",
+    "setstepus", "stepus", "setstats", "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCSETMAJORINC, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
+    LUA_GCSETSTEPUS, LUA_GCSTEPUS, LUA_GCSETSTATS, GCSTATS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   int ex = (int)luaL_optinteger(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int res;
+  if (o == GCSTATS)
+    return gcstats(L);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCSTEPUS:
+    case LUA_GCSETSTATS: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* return previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushinteger(L, res);
       return 1;
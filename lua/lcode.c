@@ -12,6 +12,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -429,6 +430,7 @@ static int addk (FuncState *fs, TValue *key, TValue *v) {
   lua_State *L = fs->ls->L;
   Proto *f = fs->f;
   TValue *idx = luaH_set(L, fs->ls->h, key);  /* index scanner table */
+  TValue kv;
   int k, oldsize;
   if (ttisinteger(idx)) {  /* is there an index there? */
     k = cast_int(ivalue(idx));
@@ -442,7 +444,8 @@ static int addk (FuncState *fs, TValue *key, TValue *v) {
   k = fs->nk;
   /* numerical value does not need GC barrier;
      table has no metatable, so it does not need to invalidate cache */
-  setivalue(idx, k);
+  setivalue(&kv, k);
+  luaH_setslot(L, fs->ls->h, idx, &kv);
   luaM_growvector(L, f->k, k, f->sizek, TValue, MAXARG_Ax, "constants");
   while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
   setobj(L, &f->k[k], v);
@@ -550,6 +553,143 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** {======================================================
+** Hoisting of lookups out of loops (see OP_HOIST)
+** =======================================================
+*/
+
+/*
+** Whether RK operand 'k' is a constant that can be the key of a
+** hoisted lookup
+*/
+static int hoistablekey (FuncState *fs, int k) {
+  TValue *v;
+  if (!ISK(k))
+    return 0;
+  v = &fs->f->k[INDEXK(k)];
+  return (ttisshrstring(v) && !isreserved(tsvalue(v)));
+}
+
+
+/*
+** Find (or add) the pair of hidden registers for the lookups of
+** 'key1' (and then of 'key2', if not -1) in upvalue 'up', and count
+** one more use of it. Return its index, or -1 if all pairs are taken.
+*/
+static int hoistpath (HoistSet *hs, int up, int key1, int key2) {
+  int p;
+  for (p = 0; p < hs->n; p++) {
+    if (hs->path[p].up == up && hs->path[p].key[0] == key1 &&
+        hs->path[p].key[1] == key2)
+      break;
+  }
+  if (p == hs->n) {  /* not found? */
+    if (p == MAXHOIST)
+      return -1;
+    hs->path[p].up = up;
+    hs->path[p].key[0] = key1;
+    hs->path[p].key[1] = key2;
+    hs->path[p].nuses = 0;
+    hs->n++;
+  }
+  hs->path[p].nuses++;
+  return p;
+}
+
+
+/*
+** Emit an OP_HOIST for the lookup 'UpValue[up][key]' that is about to
+** be coded.
+*/
+static void hoistupval (FuncState *fs, int up, int key) {
+  HoistSet *hs = fs->hs;
+  int p;
+  if (hoistablekey(fs, key) && (p = hoistpath(hs, up, key, -1)) >= 0)
+    luaK_codeABC(fs, OP_HOIST, 0, hs->base + 2 * p, 1);
+}
+
+
+/*
+** The lookup 'R(t)[key]' is about to be coded. If 'R(t)' is a temporary
+** that comes from the hoisted lookup just before it, hoist both lookups
+** together. (A local variable must keep its value, which the merged
+** OP_HOIST would skip setting.)
+*/
+static void hoisttable (FuncState *fs, int t, int key) {
+  HoistSet *hs = fs->hs;
+  Instruction *i;
+  int p, up, key1;
+  if (t < fs->nactvar || fs->pc - 2 < hs->startpc ||
+      !hoistablekey(fs, key))
+    return;
+  i = &fs->f->code[fs->pc - 2];
+  if (GET_OPCODE(i[0]) != OP_HOIST || GETARG_C(i[0]) != 1 ||
+      GET_OPCODE(i[1]) != OP_GETTABUP || GETARG_A(i[1]) != t)
+    return;
+  up = GETARG_B(i[1]);
+  key1 = GETARG_C(i[1]);
+  p = (GETARG_B(i[0]) - hs->base) / 2;
+  if (--hs->path[p].nuses == 0 && p == hs->n - 1)
+    hs->n--;  /* release pair of the first lookup */
+  p = hoistpath(hs, up, key1, key);
+  if (p >= 0)
+    SETARG_C(i[0], 2);
+  else  /* no free pair; keep hoisting only the first lookup */
+    p = hoistpath(hs, up, key1, -1);
+  SETARG_B(i[0], hs->base + 2 * p);
+}
+
+
+/*
+** Finish the loop with hidden registers 'fs->hs'. Lookups of keys
+** that the loop itself assigns to would start a new epoch in every
+** iteration; turn their OP_HOIST into no-ops (which the optimizer
+** removes). If no OP_HOIST is left, the hidden registers need no
+** initialization either.
+*/
+void luaK_closehoist (FuncState *fs) {
+  HoistSet *hs = fs->hs;
+  Proto *f = fs->f;
+  int pc, p;
+  int used = 0;
+  lu_byte stored[MAXHOIST];
+  memset(stored, 0, sizeof(stored));
+  for (pc = hs->startpc; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    if (GET_OPCODE(i) == OP_SETTABUP || GET_OPCODE(i) == OP_SETTABLE) {
+      for (p = 0; p < hs->n; p++) {
+        if (hs->path[p].key[0] == GETARG_B(i) ||
+            hs->path[p].key[1] == GETARG_B(i))
+          stored[p] = 1;
+      }
+    }
+  }
+  for (pc = hs->startpc; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    if (GET_OPCODE(i) == OP_HOIST) {
+      if (stored[(GETARG_B(i) - hs->base) / 2])
+        f->code[pc] = CREATE_ABx(OP_JMP, 0, MAXARG_sBx);  /* no-op */
+      else
+        used = 1;
+    }
+  }
+  if (!used) {  /* remove hidden registers from initial LOADNIL */
+    Instruction *i = &f->code[hs->startpc - 1];
+    lua_assert(GET_OPCODE(*i) == OP_LOADNIL);
+    if (GETARG_A(*i) + GETARG_B(*i) == hs->base + 2 * MAXHOIST - 1) {
+      if (GETARG_A(*i) < hs->base)  /* merged with a previous LOADNIL? */
+        SETARG_B(*i, hs->base - 1 - GETARG_A(*i));
+      else
+        *i = CREATE_ABx(OP_JMP, 0, MAXARG_sBx);  /* no-op */
+    }
+  }
+  fs->hs = NULL;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Ensure that expression 'e' is not a variable.
 */
@@ -570,10 +710,14 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
       if (e->u.ind.vt == VLOCAL) {  /* is 't' in a register? */
         freereg(fs, e->u.ind.t);
         op = OP_GETTABLE;
+        if (fs->hs != NULL && fs->hs->active)
+          hoisttable(fs, e->u.ind.t, e->u.ind.idx);
       }
       else {
         lua_assert(e->u.ind.vt == VUPVAL);
         op = OP_GETTABUP;  /* 't' is in an upvalue */
+        if (fs->hs != NULL && fs->hs->active)
+          hoistupval(fs, e->u.ind.t, e->u.ind.idx);
       }
       e->u.info = luaK_codeABC(fs, op, 0, e->u.ind.t, e->u.ind.idx);
       e->k = VRELOCABLE;
@@ -1201,3 +1345,885 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** {======================================================
+** Optimizer: constant propagation and dead-code elimination over the
+** finished code of a chunk
+** =======================================================
+*/
+
+/*
+** A local variable that holds the same constant during its whole
+** scope: it is initialized by a load at 'init' and no instruction
+** in (init, endpc) can change its register. (As with constant
+** folding, changes made through the debug library are ignored.)
+*/
+typedef struct ConstLocal {
+  TValue v;  /* its value */
+  int reg;  /* its register */
+  int init;  /* pc of its initializing load */
+  int endpc;  /* first pc after its scope */
+} ConstLocal;
+
+
+typedef struct OptState {
+  lua_State *L;
+  Proto *f;
+  ConstLocal *cl;  /* constant locals of 'f' */
+  int ncl;  /* number of entries in 'cl' */
+  int *target;  /* non-sequential successor of each instruction (or -1) */
+  int *newpc;  /* new position of each instruction */
+  lu_byte *live;  /* jump targets, then instructions that are kept */
+  lu_byte *nactive;  /* number of active local variables at each pc */
+} OptState;
+
+
+/*
+** Get scratch space for optimizing 'os->f' from buffer 'buff'. (The
+** parser is done with that buffer, and its owner frees it even when
+** there are errors.)
+*/
+static void openscratch (OptState *os, Mbuffer *buff) {
+  Proto *f = os->f;
+  size_t ncl = sizeof(ConstLocal) * f->sizelocvars;
+  size_t nint = sizeof(int) * (2 * f->sizecode + 1);
+  size_t n = ncl + nint + 2 * f->sizecode;
+  char *b;
+  if (luaZ_sizebuffer(buff) < n)
+    luaZ_resizebuffer(os->L, buff, n);
+  b = luaZ_buffer(buff);
+  os->cl = cast(ConstLocal *, b);
+  os->target = cast(int *, b + ncl);
+  os->newpc = os->target + f->sizecode;
+  os->live = cast(lu_byte *, b + ncl + nint);
+  os->nactive = os->live + f->sizecode;
+}
+
+
+/*
+** Return the pc that instruction 'i' at 'pc' may go to other than the
+** next one, or -1 if there is none.
+*/
+static int jumptarget (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return pc + 1 + GETARG_sBx(i);
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TEST: case OP_TESTSET:
+      return pc + 2;  /* skips next jump */
+    case OP_LOADBOOL:
+      return (GETARG_C(i)) ? pc + 2 : -1;
+    case OP_HOIST:
+      return pc + 1 + GETARG_C(i);  /* skips the lookups */
+    default: return -1;
+  }
+}
+
+
+/*
+** Whether instruction 'i' may continue with the next one
+*/
+static int fallsthrough (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORPREP: case OP_RETURN: return 0;
+    case OP_LOADBOOL: return (GETARG_C(i) == 0);
+    default: return 1;
+  }
+}
+
+
+/*
+** Compute the range [*first, *last] of registers that instruction 'i'
+** may change; the range is empty when '*first > *last'. (Calls may
+** change everything above their base.)
+*/
+static void changedregs (Instruction i, int *first, int *last) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  *first = *last = a;
+  switch (op) {
+    case OP_LOADNIL: *last = a + GETARG_B(i); break;
+    case OP_SELF: *last = a + 1; break;
+    case OP_FORLOOP: *last = a + 3; break;
+    case OP_HOIST: {  /* (the lookups it skips set their own target) */
+      *first = GETARG_B(i);
+      *last = *first + 1;
+      break;
+    }
+    case OP_CONCAT: {  /* also uses its operands as scratch */
+      if (GETARG_B(i) < a) *first = GETARG_B(i);
+      if (GETARG_C(i) > a) *last = GETARG_C(i);
+      break;
+    }
+    case OP_CALL: case OP_TAILCALL: *last = MAXREGS; break;
+    case OP_TFORCALL: *first = a + 3; *last = MAXREGS; break;
+    case OP_VARARG: {
+      *last = (GETARG_B(i) == 0) ? MAXREGS : a + GETARG_B(i) - 2;
+      break;
+    }
+    default: {
+      if (!testAMode(op))
+        *last = a - 1;  /* does not change registers */
+      break;
+    }
+  }
+}
+
+
+static int changesreg (Instruction i, int reg) {
+  int first, last;
+  changedregs(i, &first, &last);
+  return (first <= reg && reg <= last);
+}
+
+
+/*
+** If instruction 'i' loads a constant into register 'reg', put that
+** constant in 'v' and return true.
+*/
+static int loadedconst (lua_State *L, Proto *f, Instruction i, int reg,
+                        TValue *v) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK:
+      if (a != reg) return 0;
+      setobj(L, v, &f->k[GETARG_Bx(i)]);
+      return 1;
+    case OP_LOADBOOL:
+      if (a != reg) return 0;
+      setbvalue(v, GETARG_B(i));
+      return 1;
+    case OP_LOADNIL:
+      if (reg < a || reg > a + GETARG_B(i)) return 0;
+      setnilvalue(v);
+      return 1;
+    default: return 0;
+  }
+}
+
+
+/*
+** Return the index of constant 'v' in 'f', adding it if needed, or -1
+** if that index would be larger than 'limit'.
+*/
+static int constindex (lua_State *L, Proto *f, const TValue *v, int limit) {
+  int k;
+  for (k = 0; k < f->sizek && k <= limit; k++) {
+    /* (warning: must distinguish floats from integers!) */
+    if (ttype(&f->k[k]) == ttype(v) && luaV_rawequalobj(&f->k[k], v))
+      return k;
+  }
+  if (k > limit)
+    return -1;
+  luaM_reallocvector(L, f->k, f->sizek, k + 1, TValue);
+  setobj(L, &f->k[k], v);
+  f->sizek = k + 1;
+  luaC_barrier(L, f, v);
+  return k;
+}
+
+
+/*
+** Replace instruction at 'pc' by a load of constant 'v' into register
+** 'a'. Return false if the constant does not fit in a OP_LOADK.
+*/
+static int loadconst (lua_State *L, Proto *f, int pc, int a,
+                      const TValue *v) {
+  if (ttisnil(v))
+    f->code[pc] = CREATE_ABC(OP_LOADNIL, a, 0, 0);
+  else if (ttisboolean(v))
+    f->code[pc] = CREATE_ABC(OP_LOADBOOL, a, bvalue(v), 0);
+  else {
+    int k = constindex(L, f, v, MAXARG_Bx);
+    if (k < 0) return 0;
+    f->code[pc] = CREATE_ABx(OP_LOADK, a, k);
+  }
+  return 1;
+}
+
+
+/*
+** Replace the test at 'pc' by a jump that does (if 'jump') or does not
+** do the jump that follows it.
+*/
+static void foldtest (Proto *f, int pc, int jump) {
+  f->code[pc] = CREATE_ABx(OP_JMP, 0, MAXARG_sBx + (jump ? 0 : 1));
+}
+
+
+/*
+** Check whether function 'p' or any function nested in it may change
+** upvalue 'u' of 'p'.
+*/
+static int changesupval (Proto *p, int u) {
+  int pc, i, j;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction ins = p->code[pc];
+    if (GET_OPCODE(ins) == OP_SETUPVAL && GETARG_B(ins) == u)
+      return 1;
+  }
+  for (i = 0; i < p->sizep; i++) {
+    Proto *c = p->p[i];
+    for (j = 0; j < c->sizeupvalues; j++) {
+      if (!c->upvalues[j].instack && c->upvalues[j].idx == u &&
+          changesupval(c, j))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether a closure created by instruction 'i' captures register
+** 'reg' and may change it.
+*/
+static int closurechanges (Proto *f, Instruction i, int reg) {
+  if (GET_OPCODE(i) == OP_CLOSURE) {
+    Proto *c = f->p[GETARG_Bx(i)];
+    int j;
+    for (j = 0; j < c->sizeupvalues; j++) {
+      if (c->upvalues[j].instack && c->upvalues[j].idx == reg &&
+          changesupval(c, j))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether local variable with register 'reg' and scope ending
+** at 'endpc' keeps the constant loaded at 'init'. Nothing in
+** (init, endpc) may change its register, and no path may enter that
+** range other than through 'init'.
+*/
+static int isconstlocal (OptState *os, int reg, int init, int endpc) {
+  Proto *f = os->f;
+  int pc;
+  for (pc = init + 1; pc < endpc; pc++) {
+    if (changesreg(f->code[pc], reg) || closurechanges(f, f->code[pc], reg))
+      return 0;
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    int t = os->target[pc];
+    if ((pc < init || pc >= endpc) && init < t && t < endpc)
+      return 0;  /* a jump from outside enters the scope */
+  }
+  return 1;
+}
+
+
+/*
+** Collect the local variables of 'f' that are constant during their
+** whole scope. The register of a variable is the number of variables
+** still active when it starts.
+*/
+static void findconstlocals (OptState *os) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  int active[MAXREGS];  /* 'endpc' of each active variable */
+  int nactive = 0;
+  int v;
+  os->ncl = 0;
+  for (v = 0; v < f->sizelocvars; v++) {
+    LocVar *lv = &f->locvars[v];
+    int init;
+    while (nactive > 0 && active[nactive - 1] <= lv->startpc)
+      nactive--;  /* remove variables that are out of scope */
+    lua_assert(nactive < MAXREGS);
+    active[nactive++] = lv->endpc;
+    for (init = lv->startpc - 1; init >= 0; init--) {
+      if (changesreg(f->code[init], nactive - 1))
+        break;  /* found last instruction that sets the variable */
+    }
+    if (init >= 0 && lv->startpc < lv->endpc &&
+        loadedconst(L, f, f->code[init], nactive - 1, &os->cl[os->ncl].v) &&
+        isconstlocal(os, nactive - 1, init, lv->endpc)) {
+      ConstLocal *c = &os->cl[os->ncl++];
+      c->reg = nactive - 1;
+      c->init = init;
+      c->endpc = lv->endpc;
+    }
+  }
+}
+
+
+/*
+** Value of RK operand 'x', or NULL if it is a register with an unknown
+** value
+*/
+static const TValue *rkvalue (Proto *f, const TValue *kv, const lu_byte *kn,
+                              int x) {
+  if (ISK(x))
+    return &f->k[INDEXK(x)];
+  else
+    return (kn[x]) ? &kv[x] : NULL;
+}
+
+
+/*
+** Check whether value 'v' may raise an error as an operand of 'op'.
+** Such an operand stays in its register, so that the error message
+** names its variable (unless the whole instruction is folded).
+*/
+static int operror (OpCode op, const TValue *v) {
+  lua_Integer i;
+  if (op < OP_ADD || op > OP_SHR)
+    return 0;  /* not arithmetic; errors do not name these operands */
+  else if (!ttisnumber(v))
+    return 1;
+  else if (op >= OP_BAND)  /* bitwise operation? */
+    return !tointeger(v, &i);
+  else
+    return 0;
+}
+
+
+/*
+** Check whether instruction 'i' may raise an error whose message names
+** register 'reg', when that register holds value 'v'
+*/
+static int readerror (Instruction i, int reg, const TValue *v) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (op) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+      return ((!ISK(b) && reg == b) || (!ISK(c) && reg == c)) &&
+             operror(op, v);
+    case OP_UNM:
+      return (reg == b && operror(OP_ADD, v));
+    case OP_BNOT:
+      return (reg == b && operror(OP_BAND, v));
+    case OP_LEN: case OP_GETTABLE: case OP_SELF:
+      return (reg == b && !ttisstring(v));
+    case OP_CONCAT:
+      return (b <= reg && reg <= c && !ttisstring(v) && !ttisnumber(v));
+    case OP_SETTABLE: case OP_CALL: case OP_TAILCALL:
+      return (reg == a);
+    default: return 0;
+  }
+}
+
+
+/* maximum number of instructions that 'loaderror' follows */
+#define MAXFOLLOW	100
+
+
+/*
+** Check whether value 'v' in register 'reg' may raise an error whose
+** message names that register, in code from 'pc' on. Follows all paths
+** from 'pc' until the register changes, spending '*n' instructions;
+** assumes an error when they run out. Backward jumps end a path: the
+** loads that matter are into temporaries, which do not live from one
+** iteration of a loop to the next (errors about locals name them
+** anyway).
+*/
+static int reacherror (Proto *f, int pc, int reg, const TValue *v, int *n) {
+  for (; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    int t;
+    if (--*n < 0 || readerror(i, reg, v))
+      return 1;
+    else if (changesreg(i, reg) || GET_OPCODE(i) == OP_RETURN)
+      return 0;
+    t = jumptarget(i, pc);
+    if (t > pc && reacherror(f, t, reg, v, n))
+      return 1;
+    if (!fallsthrough(i))
+      return 0;
+  }
+  return 0;
+}
+
+
+/*
+** Check whether value 'v', loaded into register 'reg' by the instruction
+** at 'pc', may raise an error whose message names that register. Such
+** a load must stay a move (or an upvalue read), so that the message
+** names its variable.
+*/
+static int loaderror (Proto *f, int pc, int reg, const TValue *v) {
+  int n = MAXFOLLOW;
+  return reacherror(f, pc + 1, reg, v, &n);
+}
+
+
+/*
+** Try to fold instruction at 'pc', whose operands in registers have
+** the known values in 'kv' (where 'kn' is set). Registers with known
+** values used as RK operands are replaced by constants (unless they
+** may raise an error); operations,
+** moves, and tests over known values are replaced by loads and jumps.
+** Return true if the instruction was changed.
+*/
+static int foldinstruction (OptState *os, int pc, const TValue *kv,
+                            const lu_byte *kn) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  Instruction *i = &f->code[pc];
+  OpCode op = GET_OPCODE(*i);
+  int a = GETARG_A(*i);
+  int b = GETARG_B(*i);
+  int c = GETARG_C(*i);
+  int changed = 0;
+  const TValue *v1, *v2;
+  if (getOpMode(op) != iABC)
+    return 0;
+  if (getBMode(op) == OpArgK && !ISK(b) && kn[b] && !operror(op, &kv[b])) {
+    int k = constindex(L, f, &kv[b], MAXINDEXRK);
+    if (k >= 0) {
+      SETARG_B(*i, RKASK(k));
+      b = RKASK(k);
+      changed = 1;
+    }
+  }
+  if (getCMode(op) == OpArgK && !ISK(c) && kn[c] && !operror(op, &kv[c])) {
+    int k = constindex(L, f, &kv[c], MAXINDEXRK);
+    if (k >= 0) {
+      SETARG_C(*i, RKASK(k));
+      c = RKASK(k);
+      changed = 1;
+    }
+  }
+  switch (op) {
+    case OP_MOVE: {  /* (keeps moves of nil for error messages) */
+      if (kn[b] && !ttisnil(&kv[b]) && !loaderror(f, pc, a, &kv[b]))
+        return loadconst(L, f, pc, a, &kv[b]) || changed;
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT: {
+      TValue n1, n2, res;
+      int aop = cast_int(op - OP_ADD) + LUA_OPADD;
+      v1 = (op == OP_UNM || op == OP_BNOT) ? (kn[b] ? &kv[b] : NULL)
+                                          : rkvalue(f, kv, kn, b);
+      v2 = (op == OP_UNM || op == OP_BNOT) ? v1 : rkvalue(f, kv, kn, c);
+      if (v1 == NULL || v2 == NULL || !ttisnumber(v1) || !ttisnumber(v2))
+        break;
+      setobj(L, &n1, v1);
+      if (op == OP_UNM || op == OP_BNOT) {
+        setivalue(&n2, 0);  /* as in 'luaK_prefix' */
+      }
+      else {
+        setobj(L, &n2, v2);
+      }
+      if (!validop(aop, &n1, &n2))
+        break;
+      luaO_arith(L, aop, &n1, &n2, &res);
+      if (ttisfloat(&res) &&  /* see 'constfolding' */
+          (luai_numisnan(fltvalue(&res)) || fltvalue(&res) == 0))
+        break;
+      return loadconst(L, f, pc, a, &res) || changed;
+    }
+    case OP_NOT: {
+      if (kn[b]) {
+        f->code[pc] = CREATE_ABC(OP_LOADBOOL, a, l_isfalse(&kv[b]), 0);
+        return 1;
+      }
+      break;
+    }
+    case OP_TEST: {  /* jumps if truth of R(A) is C */
+      if (kn[a]) {
+        foldtest(f, pc, l_isfalse(&kv[a]) != c);
+        return 1;
+      }
+      break;
+    }
+    case OP_TESTSET: {
+      if (kn[b]) {
+        if (l_isfalse(&kv[b]) == c)  /* does not jump? */
+          foldtest(f, pc, 0);
+        else if (!loadconst(L, f, pc, a, &kv[b]))  /* set R(A) and jump */
+          break;
+        return 1;
+      }
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {  /* jump if comparison is A */
+      int res;
+      v1 = rkvalue(f, kv, kn, b);
+      v2 = rkvalue(f, kv, kn, c);
+      if (v1 == NULL || v2 == NULL)
+        break;
+      if (op == OP_EQ)
+        res = luaV_rawequalobj(v1, v2);
+      else if (ttisinteger(v1) && ttisinteger(v2))
+        res = (op == OP_LT) ? ivalue(v1) < ivalue(v2)
+                            : ivalue(v1) <= ivalue(v2);
+      else if (ttisfloat(v1) && ttisfloat(v2))
+        res = (op == OP_LT) ? luai_numlt(fltvalue(v1), fltvalue(v2))
+                            : luai_numle(fltvalue(v1), fltvalue(v2));
+      else
+        break;  /* other comparisons are left to the VM */
+      foldtest(f, pc, res == a);
+      return 1;
+    }
+    default: break;
+  }
+  return changed;
+}
+
+
+/*
+** Check whether register 'reg' holds a constant local whose
+** initializing load is at 'pc'
+*/
+static int initsconstlocal (OptState *os, int reg, int pc) {
+  int j;
+  for (j = 0; j < os->ncl; j++) {
+    if (os->cl[j].reg == reg && os->cl[j].init == pc)
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Forward pass over the code of 'f' that tracks registers with known
+** constant values and folds instructions that use them. Values of
+** other registers are known only inside straight-line code; at a jump
+** target, only constant locals in scope keep their values. Registers
+** captured by closures can change in any call, so only constant
+** locals are tracked there.
+*/
+static int propagateconsts (OptState *os) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  TValue kv[MAXREGS];  /* known values */
+  lu_byte kn[MAXREGS];  /* whether each register has a known value */
+  lu_byte captured[MAXREGS];  /* registers captured by closures */
+  int pc, changed = 0;
+  memset(captured, 0, sizeof(captured));
+  memset(os->live, 0, f->sizecode);  /* mark jump targets */
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (os->target[pc] >= 0 && os->target[pc] < f->sizecode)
+      os->live[os->target[pc]] = 1;
+    if (GET_OPCODE(i) == OP_CLOSURE) {
+      Proto *c = f->p[GETARG_Bx(i)];
+      int j;
+      for (j = 0; j < c->sizeupvalues; j++) {
+        if (c->upvalues[j].instack)
+          captured[c->upvalues[j].idx] = 1;
+      }
+    }
+  }
+  memset(kn, 0, sizeof(kn));
+  for (pc = 0; pc < f->sizecode; pc++) {
+    int first, last, r;
+    if (os->live[pc]) {  /* join of paths? */
+      int j;
+      memset(kn, 0, sizeof(kn));
+      for (j = 0; j < os->ncl; j++) {
+        ConstLocal *c = &os->cl[j];
+        if (c->init < pc && pc < c->endpc) {
+          setobj(L, &kv[c->reg], &c->v);
+          kn[c->reg] = 1;
+        }
+      }
+    }
+    if (GET_OPCODE(f->code[pc]) == OP_EXTRAARG)
+      continue;
+    changed |= foldinstruction(os, pc, kv, kn);
+    changedregs(f->code[pc], &first, &last);
+    if (last >= f->maxstacksize)
+      last = f->maxstacksize - 1;
+    for (r = first; r <= last; r++)
+      kn[r] = loadedconst(L, f, f->code[pc], r, &kv[r]) &&
+              (!captured[r] || initsconstlocal(os, r, pc));
+  }
+  return changed;
+}
+
+
+/*
+** Check whether instruction 'i' may read register 'reg'
+*/
+static int readsreg (Instruction i, int reg) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL: case OP_LOADNIL:
+    case OP_GETUPVAL: case OP_NEWTABLE: case OP_VARARG: case OP_EXTRAARG:
+      return 0;
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_TESTSET:
+      return (reg == b);
+    case OP_GETTABUP:
+      return (!ISK(c) && reg == c);
+    case OP_GETTABLE: case OP_SELF:
+      return (reg == b || (!ISK(c) && reg == c));
+    case OP_SETTABLE:
+      if (reg == a) return 1;
+      /* FALLTHROUGH */
+    case OP_SETTABUP:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_EQ: case OP_LT: case OP_LE:
+      return ((!ISK(b) && reg == b) || (!ISK(c) && reg == c));
+    case OP_SETUPVAL: case OP_TEST:
+      return (reg == a);
+    case OP_CONCAT:
+      return (b <= reg && reg <= c);
+    case OP_CALL: case OP_TAILCALL:
+      return (a <= reg && (b == 0 || reg < a + b));
+    case OP_RETURN:
+      return (a <= reg && (b == 0 || reg < a + b - 1));
+    case OP_SETLIST:
+      return (a <= reg && (b == 0 || reg <= a + b));
+    default:  /* loops, closures, and jumps */
+      return 1;
+  }
+}
+
+
+/*
+** Remove loads into temporary registers (registers above the active
+** locals) that are overwritten or left unused by a return before being
+** read in the same straight-line code. Folding leaves such loads
+** behind when it removes their uses.
+*/
+static int removedeadloads (OptState *os) {
+  Proto *f = os->f;
+  int *delta = os->newpc;  /* (free before 'removedeadcode') */
+  int pc, n = 0, changed = 0;
+  memset(delta, 0, sizeof(int) * (f->sizecode + 1));
+  for (pc = 0; pc < f->sizelocvars; pc++) {
+    delta[f->locvars[pc].startpc]++;
+    delta[f->locvars[pc].endpc]--;
+  }
+  for (pc = 0; pc < f->sizecode; pc++)
+    os->nactive[pc] = cast_byte(n += delta[pc]);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    int r = GETARG_A(i);
+    int j;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK: case OP_GETUPVAL: case OP_MOVE: break;
+      case OP_LOADBOOL: if (GETARG_C(i) == 0) break; else continue;
+      case OP_LOADNIL: if (GETARG_B(i) == 0) break; else continue;
+      default: continue;  /* not a simple load */
+    }
+    if (r < os->nactive[pc])
+      continue;  /* not a temporary */
+    for (j = pc + 1; j < f->sizecode && !os->live[j]; j++) {
+      Instruction ij = f->code[j];
+      if (readsreg(ij, r) || r < os->nactive[j])
+        break;  /* load is used */
+      if (changesreg(ij, r) || GET_OPCODE(ij) == OP_RETURN) {
+        f->code[pc] = CREATE_ABx(OP_JMP, 0, MAXARG_sBx);  /* no-op */
+        changed = 1;
+        break;
+      }
+      if (!fallsthrough(ij) || os->target[j] >= 0)
+        break;  /* end of straight-line code */
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Remove unreachable instructions and jumps to the next instruction,
+** and fix jump offsets, line information, and scopes of locals.
+** Return true if anything was removed.
+*/
+static int removedeadcode (OptState *os) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  int *stack = os->newpc;  /* (used as a work list before renumbering) */
+  int n = 0;
+  int pc, npc;
+  memset(os->live, 0, f->sizecode);
+  os->live[0] = 1;
+  stack[n++] = 0;
+  while (n > 0) {  /* mark reachable instructions */
+    Instruction i;
+    int t;
+    pc = stack[--n];
+    i = f->code[pc];
+    t = jumptarget(i, pc);
+    if (fallsthrough(i) && pc + 1 < f->sizecode && !os->live[pc + 1]) {
+      os->live[pc + 1] = 1;
+      stack[n++] = pc + 1;
+    }
+    if (t >= 0 && t < f->sizecode && !os->live[t]) {
+      os->live[t] = 1;
+      stack[n++] = t;
+    }
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (GET_OPCODE(i) == OP_JMP && GETARG_sBx(i) == 0 && GETARG_A(i) == 0 &&
+        !(pc > 0 && testTMode(GET_OPCODE(f->code[pc - 1]))))
+      os->live[pc] = 0;  /* jump to next instruction does nothing */
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (os->live[pc] && GET_OPCODE(i) == OP_LOADBOOL && GETARG_C(i) &&
+        pc + 1 < f->sizecode)
+      os->live[pc + 1] = 1;  /* keep the instruction it skips */
+  }
+  os->live[f->sizecode - 1] = 1;  /* keep final return */
+  npc = 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    os->newpc[pc] = npc;
+    npc += os->live[pc];
+  }
+  if (npc == f->sizecode)
+    return 0;  /* nothing to remove */
+  os->newpc[f->sizecode] = npc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    if (os->live[pc]) {
+      Instruction i = f->code[pc];
+      switch (GET_OPCODE(i)) {
+        case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: {
+          int t = pc + 1 + GETARG_sBx(i);
+          SETARG_sBx(i, os->newpc[t] - (os->newpc[pc] + 1));
+          break;
+        }
+        default: break;
+      }
+      f->code[os->newpc[pc]] = i;
+      f->lineinfo[os->newpc[pc]] = f->lineinfo[pc];
+    }
+  }
+  for (pc = 0; pc < f->sizelocvars; pc++) {
+    LocVar *lv = &f->locvars[pc];
+    lv->startpc = os->newpc[lv->startpc];
+    lv->endpc = os->newpc[lv->endpc];
+  }
+  luaM_reallocvector(L, f->code, f->sizecode, npc, Instruction);
+  f->sizecode = npc;
+  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, npc, int);
+  f->sizelineinfo = npc;
+  return 1;
+}
+
+
+/*
+** Replace reads of upvalue 'u' of 'p' (and of the upvalues that
+** capture it in nested functions) by loads of constant 'v', except
+** reads whose value may raise an error that names the upvalue.
+*/
+static void propagateupval (lua_State *L, Proto *p, int u, const TValue *v) {
+  int pc, i, j;
+  if (ttisnil(v))
+    return;  /* keep names in error messages about nil values */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction ins = p->code[pc];
+    if (GET_OPCODE(ins) == OP_GETUPVAL && GETARG_B(ins) == u &&
+        !loaderror(p, pc, GETARG_A(ins), v))
+      loadconst(L, p, pc, GETARG_A(ins), v);
+  }
+  for (i = 0; i < p->sizep; i++) {
+    Proto *c = p->p[i];
+    for (j = 0; j < c->sizeupvalues; j++) {
+      if (!c->upvalues[j].instack && c->upvalues[j].idx == u)
+        propagateupval(L, c, j, v);
+    }
+  }
+}
+
+
+/*
+** Optimize the code of 'f' and of all functions nested in it: values of
+** locals that are constant during their whole scope (and of upvalues
+** that capture them) are propagated and folded, and code made
+** unreachable by folded tests is removed. Must run before inline caches
+** are created and instructions are fused. The optimized code does not
+** see changes made through 'debug.setlocal' and 'debug.setupvalue', so
+** the parser runs this pass only with option LUA_COPTCONST.
+*/
+void luaK_optimize (lua_State *L, Proto *f, Mbuffer *buff) {
+  OptState os;
+  int changed, j, pc, i;
+  os.L = L;
+  os.f = f;
+  do {
+    openscratch(&os, buff);
+    for (pc = 0; pc < f->sizecode; pc++)
+      os.target[pc] = jumptarget(f->code[pc], pc);
+    findconstlocals(&os);
+    changed = propagateconsts(&os);
+    changed |= removedeadloads(&os);
+    changed |= removedeadcode(&os);
+  } while (changed);
+  for (j = 0; j < os.ncl; j++) {  /* propagate into nested functions */
+    ConstLocal *c = &os.cl[j];
+    for (pc = c->init + 1; pc < c->endpc; pc++) {
+      Instruction ins = f->code[pc];
+      if (GET_OPCODE(ins) == OP_CLOSURE) {
+        Proto *p = f->p[GETARG_Bx(ins)];
+        for (i = 0; i < p->sizeupvalues; i++) {
+          if (p->upvalues[i].instack && p->upvalues[i].idx == c->reg)
+            propagateupval(L, p, i, &c->v);
+        }
+      }
+    }
+  }
+  for (i = 0; i < f->sizep; i++)
+    luaK_optimize(L, f->p[i], buff);
+}
+
+/* }====================================================== */
+
+
+#if !defined(LUAI_OPPAIRSTATS)
+
+/*
+** Pairs of consecutive instructions fused into superinstructions,
+** chosen from the opcode-pair counts of a profiling build (see
+** LUAI_OPPAIRSTATS in lvm.c). (Comparisons and tests need no entries:
+** the interpreter always executes them together with the jump that
+** follows them.)
+*/
+static const struct {
+  lu_byte first, second, fused;
+} fusedpairs[] = {
+  {OP_MOVE, OP_CALL, OP_MOVECALL},
+  {OP_GETTABUP, OP_GETTABLE, OP_GETTABUPTAB},
+  {OP_GETTABLE, OP_ADD, OP_GETTABADD},
+  {OP_MUL, OP_ADD, OP_MULADD},
+  {OP_ADD, OP_FORLOOP, OP_ADDFORLOOP},
+  {OP_SETTABLE, OP_FORLOOP, OP_SETTABFORLOOP}
+};
+
+
+/*
+** Peephole pass over the finished code of 'f': replace the first
+** instruction of each pair in 'fusedpairs' by the corresponding
+** superinstruction.
+*/
+void luaK_fuse (Proto *f) {
+  int pc;
+  for (pc = 0; pc + 1 < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode second = GET_OPCODE(*(i + 1));
+    unsigned int k;
+    for (k = 0; k < sizeof(fusedpairs) / sizeof(fusedpairs[0]); k++) {
+      if (GET_OPCODE(*i) == fusedpairs[k].first &&
+          second == fusedpairs[k].second) {
+        SET_OPCODE(*i, fusedpairs[k].fused);
+        break;
+      }
+    }
+  }
+}
+
+#else
+
+/* the profiling build keeps the code unchanged, to count original pairs */
+void luaK_fuse (Proto *f) {
+  UNUSED(f);
+}
+
+#endif
+
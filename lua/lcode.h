@@ -83,6 +83,9 @@ LUAI_FUNC void luaK_infix (FuncState *fs, BinOpr op, expdesc *v);
 LUAI_FUNC void luaK_posfix (FuncState *fs, BinOpr op, expdesc *v1,
                             expdesc *v2, int line);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
+LUAI_FUNC void luaK_closehoist (FuncState *fs);
+LUAI_FUNC void luaK_optimize (lua_State *L, Proto *f, Mbuffer *buff);
+LUAI_FUNC void luaK_fuse (Proto *f);
 
 
 #endif
@@ -414,6 +414,43 @@ static int db_debug (lua_State *L) {
 }
 
 
+/*
+** debug.heapprofile([rate]): start, retune or (with 0) stop the heap
+** profiler; returns the previous rate
+*/
+static int db_heapprofile (lua_State *L) {
+  int rate = (int)luaL_optinteger(L, 1, -1);
+  luaL_argcheck(L, rate >= -1, 1, "invalid rate");
+  lua_pushinteger(L, lua_heapprofile(L, rate));
+  return 1;
+}
+
+
+static int heapwriter (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+/*
+** debug.heapdump([what]): the profile as folded stacks (nil if the
+** profiler is off)
+*/
+static int db_heapdump (lua_State *L) {
+  static const char *const opts[] = {"live", "alloc", "freed", NULL};
+  static const int optsnum[] = {LUA_PROFLIVE, LUA_PROFALLOC, LUA_PROFFREED};
+  int what = optsnum[luaL_checkoption(L, 1, "live", opts)];
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  if (lua_heapdump(L, what, heapwriter, &b) != 0)
+    lua_pushnil(L);
+  else
+    luaL_pushresult(&b);
+  return 1;
+}
+
+
 static int db_traceback (lua_State *L) {
   int arg;
   lua_State *L1 = getthread(L, &arg);
@@ -432,6 +469,8 @@ static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
+  {"heapdump", db_heapdump},
+  {"heapprofile", db_heapprofile},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
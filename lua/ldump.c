@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -87,9 +88,22 @@ static void DumpString (const TString *s, DumpState *D) {
 }
 
 
+/*
+** Dump the code of 'f' with every instruction in its regular form,
+** as the interpreter may have quickened some of them. An OP_HOIST
+** becomes a no-op, so that the lookups after it always run and the
+** chunk keeps the official format.
+*/
 static void DumpCode (const Proto *f, DumpState *D) {
+  int i;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction inst = f->code[i];
+    SET_OPCODE(inst, GET_BASEOPCODE(inst));
+    if (GET_OPCODE(inst) == OP_HOIST)
+      inst = CREATE_ABx(OP_JMP, 0, MAXARG_sBx);  /* no-op */
+    DumpVar(inst, D);
+  }
 }
 
 
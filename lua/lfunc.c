@@ -16,6 +16,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -104,6 +105,9 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->jitcount = G(L)->jithot;
   f->cache = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
@@ -122,8 +126,24 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Create the inline caches for the code of prototype 'f'. Each
+** instruction owns one slot, which starts empty (zero).
+*/
+void luaF_newicache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, f->sizecode);
+  if (f->jit != NULL)
+    luaJ_freecode(L, f);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
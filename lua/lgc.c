@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -26,6 +27,17 @@
 #include "ltm.h"
 
 
+/*
+** The collector runs only on the thread that runs the state. Marking
+** on another thread, beside the mutator, would need TValues (written as
+** two plain stores) to be written atomically, the blocks freed when
+** tables or the string table resize to outlive any marker reading
+** them, and atomic updates of the 'marked' bytes that barriers also
+** change: costs on the interpreter's most frequent paths. Pauses are
+** kept short by incremental and generational collection instead.
+*/
+
+
 /*
 ** internal state for collector while inside the atomic phase. The
 ** collector should never be in this state while running regular code.
@@ -44,6 +56,19 @@
 /* cost of calling one finalizer */
 #define GCFINALIZECOST	GCSWEEPCOST
 
+/*
+** objects with finalizers are searched for in at most that many first
+** elements of 'allgc' before going to 'finpend'
+*/
+#if !defined(LUAI_FINSEARCH)
+#define LUAI_FINSEARCH	16
+#endif
+
+/* initial size of 'finpend' */
+#if !defined(LUAI_MINFINPEND)
+#define LUAI_MINFINPEND	64
+#endif
+
 
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
@@ -60,10 +85,22 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** clock for time-budgeted steps, in microseconds. The default, from
+** ANSI 'clock', measures processor time; a host may define a wall
+** clock instead.
+*/
+#if !defined(luai_gcclock)
+#include <time.h>
+#define luai_gcclock()  \
+	cast(l_mem, cast(double, clock()) * (1000000.0 / CLOCKS_PER_SEC))
+#endif
+
+
+/*
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -107,6 +144,33 @@ static void reallymarkobject (global_State *g, GCObject *o);
 #define gnodelast(h)	gnode(h, cast(size_t, sizenode(h)))
 
 
+/*
+** Set 'first' and 'limit' to the 'r'-th range of nodes of table 'h'
+** that may hold entries: first its hash part and, while it is being
+** resized, the nodes of the old hash part whose entries have not moved
+** yet. Return false when there is no such range.
+*/
+static int noderange (Table *h, int r, Node **first, Node **limit) {
+  if (r == 0) {
+    *first = gnode(h, 0);
+    *limit = gnodelast(h);
+    return 1;
+  }
+  else if (r == 1 && h->old != NULL) {
+    *first = h->old->node + h->old->next;
+    *limit = h->old->node + h->old->size;
+    return 1;
+  }
+  else return 0;
+}
+
+
+/* loop over all nodes 'n' of table 'h' that may hold entries */
+#define fornodes(h,n,limit,r)  \
+  for (r = 0; noderange(h, r, &n, &limit); r++) \
+    for (; n < limit; n++)
+
+
 /*
 ** link collectable object 'o' into list pointed by 'p'
 */
@@ -219,6 +283,148 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 
 
 
+/*
+** {======================================================
+** Card maps
+** =======================================================
+*/
+
+
+/*
+** A back barrier makes a black table gray, so that the atomic phase
+** traverses it again; for a large table that is mostly unchanged, that
+** is a waste. So, in large tables, 'luaC_barrierslot_' marks as dirty
+** only the card (a range of CARDSIZE array slots or hash nodes) with
+** the assigned slot and keeps the table black, with its card map in
+** list 'dirtycards'; the atomic phase traverses only the dirty cards.
+** When a barrier cannot place its slot, or entries moved since the map
+** was made, the whole table is dirty ('all').
+*/
+#define CARDBITS	7
+#define CARDSIZE	(1u << CARDBITS)
+
+/* number of cards for 'n' slots */
+#define ncards(n)	(((n) + CARDSIZE - 1) >> CARDBITS)
+
+/* tables with fewer slots than that do without cards */
+#if !defined(LUAI_MINCARDED)
+#define LUAI_MINCARDED	4096
+#endif
+
+
+typedef struct Cards {
+  struct Cards *next;  /* next map in list 'dirtycards' */
+  Table *t;  /* table of this map */
+  unsigned int narray;  /* number of cards for the array part */
+  unsigned int nnode;  /* number of cards for the hash part */
+  lu_byte indirty;  /* true if in list 'dirtycards' */
+  lu_byte all;  /* true if the whole table is dirty */
+  lu_byte d[1];  /* dirty flags for array cards, then for hash cards */
+} Cards;
+
+#define sizecards(na,nn)	(offsetof(Cards, d) + (na) + (nn))
+
+
+/*
+** Create a card map for table 't', if it is large enough. A barrier
+** cannot run a collection (or raise an error) in the middle of an
+** assignment, so this calls the allocation function directly; if it
+** fails, the table does without a map.
+*/
+static Cards *newcards (global_State *g, Table *t) {
+  unsigned int na = ncards(t->sizearray);
+  unsigned int nn = ncards(cast(unsigned int, allocsizenode(t)));
+  Cards *c;
+  if (t->sizearray + allocsizenode(t) < LUAI_MINCARDED)
+    return NULL;  /* small table */
+  c = cast(Cards *, (*g->frealloc)(g->ud, NULL, 0, sizecards(na, nn)));
+  if (c == NULL)
+    return NULL;
+  g->GCdebt += sizecards(na, nn);
+  c->t = t;
+  c->narray = na;
+  c->nnode = nn;
+  c->indirty = c->all = 0;
+  memset(c->d, 0, na + nn);
+  t->cards = c;
+  return c;
+}
+
+
+/*
+** Mark as dirty the card of 'slot', an array slot or the key or value
+** of a node of table 't' (or the whole table, if 'slot' is neither).
+*/
+static void markcard (Cards *c, Table *t, const TValue *slot) {
+  const char *p = cast(const char *, slot);
+  const char *node = cast(const char *, t->node);
+  unsigned int i;
+  if (!ispacked(t) && t->array <= slot && slot < t->array + t->sizearray) {
+    i = cast(unsigned int, slot - t->array) >> CARDBITS;
+    if (i < c->narray) {
+      c->d[i] = 1;
+      return;
+    }
+  }
+  else if (!isdummy(t) && node <= p && p < node + sizenode(t) * sizeof(Node)) {
+    i = cast(unsigned int, (p - node) / sizeof(Node)) >> CARDBITS;
+    if (i < c->nnode) {
+      c->d[c->narray + i] = 1;
+      return;
+    }
+  }
+  c->all = 1;
+}
+
+
+/*
+** back barrier for an assignment through 'slot' in table 't'; keeps a
+** large table black, marking only the card of 'slot'
+*/
+void luaC_barrierslot_ (lua_State *L, Table *t, const TValue *slot) {
+  global_State *g = G(L);
+  Cards *c = t->cards;
+  lua_assert(isblack(t) && !isdead(g, t));
+  if (!keepinvariant(g) || (c == NULL && (c = newcards(g, t)) == NULL)) {
+    luaC_barrierback_(L, t);  /* traverse the whole table again */
+    return;
+  }
+  if (!c->all)
+    markcard(c, t, slot);
+  if (!c->indirty) {
+    c->indirty = 1;
+    c->next = g->dirtycards;
+    g->dirtycards = c;
+  }
+}
+
+
+/*
+** Entries of 't' may move (it is being resized), so its card map cannot
+** locate them anymore: the whole table must be traversed when dirty.
+*/
+void luaC_tablemoved_ (Table *t) {
+  t->cards->all = 1;
+}
+
+
+/*
+** clean all card maps in list 'dirtycards' (a new cycle marks all
+** tables anew)
+*/
+static void cleancards (global_State *g) {
+  Cards *c;
+  for (c = g->dirtycards; c != NULL; c = c->next) {
+    memset(c->d, 0, c->narray + c->nnode);
+    c->indirty = c->all = 0;
+  }
+  g->dirtycards = NULL;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Mark functions
@@ -307,7 +513,8 @@ static void markbeingfnz (global_State *g) {
 ** Mark all values stored in marked open upvalues from non-marked threads.
 ** (Values from marked threads were already marked when traversing the
 ** thread.) Remove from the list threads that no longer have upvalues and
-** not-marked threads.
+** not-marked threads. In generational mode, old closures are not
+** traversed by young collections, so all those upvalues count as marked.
 */
 static void remarkupvals (global_State *g) {
   lua_State *thread;
@@ -321,7 +528,7 @@ static void remarkupvals (global_State *g) {
       *p = thread->twups;  /* remove thread from the list */
       thread->twups = thread;  /* mark that it is out of list */
       for (uv = thread->openupval; uv != NULL; uv = uv->u.open.next) {
-        if (uv->u.open.touched) {
+        if (uv->u.open.touched || isgenerational(g)) {
           markvalue(g, uv->v);  /* remark upvalue's value */
           uv->u.open.touched = 0;
         }
@@ -337,6 +544,7 @@ static void remarkupvals (global_State *g) {
 static void restartcollection (global_State *g) {
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
+  cleancards(g);
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
@@ -359,11 +567,12 @@ static void restartcollection (global_State *g) {
 ** put it in 'weak' list, to be cleared.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int r;
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  int hasclears = (sizetvarray(h) > 0);
+  fornodes(h, n, limit, r) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -376,7 +585,7 @@ static void traverseweakvalue (global_State *g, Table *h) {
   }
   if (g->gcstate == GCSpropagate)
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
-  else if (hasclears)
+  else if (hasclears || isgenerational(g))  /* (see 'keepgrays') */
     linkgclist(h, g->weak);  /* has to be cleared later */
 }
 
@@ -395,17 +604,18 @@ static int traverseephemeron (global_State *g, Table *h) {
   int marked = 0;  /* true if an object is marked in this traversal */
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int r;
   unsigned int i;
   /* traverse array part */
-  for (i = 0; i < h->sizearray; i++) {
+  for (i = 0; i < sizetvarray(h); i++) {
     if (valiswhite(&h->array[i])) {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
   /* traverse hash part */
-  for (n = gnode(h, 0); n < limit; n++) {
+  fornodes(h, n, limit, r) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -424,27 +634,32 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasww)  /* table has white->white entries? */
     linkgclist(h, g->ephemeron);  /* have to propagate again */
-  else if (hasclears)  /* table has white keys? */
+  else if (hasclears || isgenerational(g))  /* white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
   return marked;
 }
 
 
+static void traversenode (global_State *g, Node *n) {
+  checkdeadkey(n);
+  if (ttisnil(gval(n)))  /* entry is empty? */
+    removeentry(n);  /* remove it */
+  else {
+    lua_assert(!ttisnil(gkey(n)));
+    markvalue(g, gkey(n));  /* mark key */
+    markvalue(g, gval(n));  /* mark value */
+  }
+}
+
+
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int r;
   unsigned int i;
-  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+  for (i = 0; i < sizetvarray(h); i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    checkdeadkey(n);
-    if (ttisnil(gval(n)))  /* entry is empty? */
-      removeentry(n);  /* remove it */
-    else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      markvalue(g, gval(n));  /* mark value */
-    }
-  }
+  fornodes(h, n, limit, r)  /* traverse hash part */
+    traversenode(g, n);
 }
 
 
@@ -467,7 +682,8 @@ static lu_mem traversetable (global_State *g, Table *h) {
   else  /* not weak */
     traversestrongtable(g, h);
   return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+                         sizeof(Node) * cast(size_t, allocsizenode(h)) +
+                         (h->old ? sizeof(Node) * h->old->size : 0);
 }
 
 
@@ -490,6 +706,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         sizeof(unsigned int) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -560,6 +777,7 @@ static void propagatemark (global_State *g) {
   lu_mem size;
   GCObject *o = g->gray;
   lua_assert(isgray(o));
+  if (g->gcstats) g->gcstats->cur.traversed++;
   gray2black(o);
   switch (o->tt) {
     case LUA_TTABLE: {
@@ -612,6 +830,7 @@ static void convergeephemerons (global_State *g) {
     GCObject *next = g->ephemeron;  /* get ephemeron list */
     g->ephemeron = NULL;  /* tables may return to this list when traversed */
     changed = 0;
+    if (g->gcstats) g->gcstats->cur.ephemeronpasses++;
     while ((w = next) != NULL) {
       next = gco2t(w)->gclist;
       if (traverseephemeron(g, gco2t(w))) {  /* traverse marked some value? */
@@ -622,6 +841,58 @@ static void convergeephemerons (global_State *g) {
   } while (changed);
 }
 
+/*
+** Traverse the dirty cards of the (black) tables in list 'dirtycards'
+** and clean their maps. A map whose sizes no longer match its table is
+** freed; a later barrier will make a new one.
+*/
+static void traversedirty (lua_State *L, global_State *g) {
+  Cards *c = g->dirtycards;
+  g->dirtycards = NULL;
+  while (c != NULL) {
+    Cards *next = c->next;
+    Table *h = c->t;
+    lua_assert(isblack(h) || isgray(h));
+    if (c->all) {
+      traversestrongtable(g, h);
+      g->GCmemtrav += sizeof(TValue) * h->sizearray +
+                      sizeof(Node) * allocsizenode(h);
+    }
+    else {
+      unsigned int i, j, lim;
+      for (i = 0; i < c->narray; i++) {
+        if (c->d[i]) {
+          lim = (i + 1) << CARDBITS;
+          if (lim > sizetvarray(h)) lim = sizetvarray(h);
+          for (j = i << CARDBITS; j < lim; j++)
+            markvalue(g, &h->array[j]);
+          g->GCmemtrav += sizeof(TValue) * CARDSIZE;
+        }
+      }
+      for (i = 0; i < c->nnode; i++) {
+        if (c->d[c->narray + i]) {
+          lim = (i + 1) << CARDBITS;
+          if (lim > cast(unsigned int, allocsizenode(h)))
+            lim = allocsizenode(h);
+          for (j = i << CARDBITS; j < lim; j++)
+            traversenode(g, gnode(h, j));
+          g->GCmemtrav += sizeof(Node) * CARDSIZE;
+        }
+      }
+    }
+    if (c->narray == ncards(h->sizearray) &&
+        c->nnode == ncards(cast(unsigned int, allocsizenode(h)))) {
+      memset(c->d, 0, c->narray + c->nnode);
+      c->indirty = c->all = 0;
+    }
+    else {  /* table was resized */
+      h->cards = NULL;
+      luaM_freemem(L, c, sizecards(c->narray, c->nnode));
+    }
+    c = next;
+  }
+}
+
 /* }====================================================== */
 
 
@@ -639,8 +910,9 @@ static void convergeephemerons (global_State *g) {
 static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++) {
+    Node *n, *limit;
+    int r;
+    fornodes(h, n, limit, r) {
       if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
       }
@@ -658,14 +930,15 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
 static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
+    int r;
     unsigned int i;
-    for (i = 0; i < h->sizearray; i++) {
+    for (i = 0; i < sizetvarray(h); i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
+    fornodes(h, n, limit, r) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
@@ -695,6 +968,9 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  l_mem debt = g->GCdebt;  /* to count the memory freed */
+  int tt = novariant(o->tt);
   switch (o->tt) {
     case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
     case LUA_TLCL: {
@@ -705,7 +981,14 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizeCclosure(gco2ccl(o)->nupvalues));
       break;
     }
-    case LUA_TTABLE: luaH_free(L, gco2t(o)); break;
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      if (h->cards != NULL)
+        luaM_freemem(L, h->cards, sizecards(h->cards->narray,
+                                            h->cards->nnode));
+      luaH_free(L, h);
+      break;
+    }
     case LUA_TTHREAD: luaE_freethread(L, gco2th(o)); break;
     case LUA_TUSERDATA: luaM_freemem(L, o, sizeudata(gco2u(o))); break;
     case LUA_TSHRSTR:
@@ -718,6 +1001,10 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     default: lua_assert(0);
   }
+  if (g->gcstats) {  /* count it by type (prototypes as functions) */
+    if (tt == LUA_TPROTO) tt = LUA_TFUNCTION;
+    g->gcstats->cur.freed[tt] += debt - g->GCdebt;
+  }
 }
 
 
@@ -743,6 +1030,13 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
     }
+    else if (testbit(marked, FINPENDBIT)) {  /* belongs to 'finobj'? */
+      curr->marked = cast_byte((marked & maskcolors & ~bitmask(FINPENDBIT))
+                               | white);
+      *p = curr->next;  /* move it to 'finobj' */
+      curr->next = g->finobj;
+      g->finobj = curr;
+    }
     else {  /* change mark to 'white' */
       curr->marked = cast_byte((marked & maskcolors) | white);
       p = &curr->next;  /* go to next element */
@@ -792,6 +1086,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* see MOVE OLD rule */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -856,10 +1151,10 @@ static int runafewfinalizers (lua_State *L) {
 /*
 ** call all pending finalizers
 */
-static void callallpendingfinalizers (lua_State *L) {
+static void callallpendingfinalizers (lua_State *L, int propagateerrors) {
   global_State *g = G(L);
   while (g->tobefnz)
-    GCTM(L, 0);
+    GCTM(L, propagateerrors);
 }
 
 
@@ -896,8 +1191,100 @@ static void separatetobefnz (global_State *g, int all) {
 
 
 /*
-** if object 'o' has a finalizer, remove it from 'allgc' list (must
-** search the list to find it) and link it in 'finobj' list.
+** Append 'o' to 'finpend', growing it with the raw allocation function
+** (setting a metatable cannot raise errors or run the collector).
+** Return false if there is no memory for that.
+*/
+static int addfinpend (global_State *g, GCObject *o) {
+  if (g->nfinpend == g->sizefinpend) {
+    int osize = g->sizefinpend;
+    int nsize;
+    GCObject **v;
+    if (osize >= MAX_INT / 2 ||
+        cast(size_t, osize) >= MAX_SIZET / sizeof(GCObject *) / 2)
+      return 0;  /* too large */
+    nsize = (osize == 0) ? LUAI_MINFINPEND : osize * 2;
+    v = cast(GCObject **, (*g->frealloc)(g->ud, g->finpend,
+                          osize * sizeof(GCObject *),
+                          nsize * sizeof(GCObject *)));
+    if (v == NULL)
+      return 0;
+    g->GCdebt += (nsize - osize) * sizeof(GCObject *);
+    g->finpend = v;
+    g->sizefinpend = nsize;
+  }
+  g->finpend[g->nfinpend++] = o;
+  return 1;
+}
+
+
+/*
+** Atomic phase, before separating objects to be finalized: drop from
+** 'finpend' the objects already moved to 'finobj' and mark the dead ones
+** still waiting in 'allgc'. Searching 'allgc' for them would make the
+** atomic phase proportional to the whole heap; instead they survive this
+** cycle, the sweep moves them to 'finobj', and their finalizers run at
+** the end of the next cycle. (Full collections move them before they
+** start; see 'luaC_fullgc'.)
+*/
+static void checkfinpend (global_State *g) {
+  int i;
+  int n = 0;
+  for (i = 0; i < g->nfinpend; i++) {
+    GCObject *o = g->finpend[i];
+    if (testbit(o->marked, FINPENDBIT)) {  /* still in 'allgc'? */
+      markobject(g, o);  /* keep it (and what it uses) for the sweep */
+      g->finpend[n++] = o;
+    }
+  }
+  g->nfinpend = n;
+}
+
+
+/*
+** Move all objects waiting in 'allgc' to 'finobj', with one pass over
+** 'allgc' (outside sweeps, and in generational mode only while all
+** objects are young)
+*/
+static void movefinpend (global_State *g) {
+  GCObject **p = &g->allgc;
+  GCObject *curr;
+  if (g->nfinpend == 0)
+    return;
+  while ((curr = *p) != NULL) {
+    if (testbit(curr->marked, FINPENDBIT)) {
+      resetbit(curr->marked, FINPENDBIT);
+      *p = curr->next;
+      curr->next = g->finobj;
+      g->finobj = curr;
+    }
+    else
+      p = &curr->next;
+  }
+  g->nfinpend = 0;
+}
+
+
+/*
+** Move all objects waiting in 'allgc' to 'finobj' and free 'finpend'
+** (when closing the state)
+*/
+static void flushfinpend (lua_State *L, global_State *g) {
+  movefinpend(g);
+  luaM_freearray(L, g->finpend, g->sizefinpend);
+  g->finpend = NULL;
+  g->nfinpend = g->sizefinpend = 0;
+}
+
+
+/*
+** if object 'o' has a finalizer, remove it from 'allgc' list and link
+** it in 'finobj' list. Only an object near the front of 'allgc'
+** (usually one just created) moves at once; searching the list for the
+** others would make registering many of them quadratic. Instead, they
+** are flagged and kept in 'finpend' until the next sweep of 'allgc'
+** moves them; if they die before that, the atomic phase keeps them alive
+** for one more cycle.
 */
 void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
   global_State *g = G(L);
@@ -906,6 +1293,13 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     return;  /* nothing to be done */
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
+    int n = 0;
+    for (p = &g->allgc; *p != o && n < LUAI_FINSEARCH; p = &(*p)->next)
+      n++;
+    if (*p != o && addfinpend(g, o)) {  /* not near the front? */
+      setbits(o->marked, bit2mask(FINALIZEDBIT, FINPENDBIT));
+      return;  /* it will move later */
+    }
     if (issweepphase(g)) {
       makewhite(g, o);  /* "sweep" object 'o' */
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
@@ -917,6 +1311,87 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* see MOVE OLD rule */
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+
+/*
+** Charge the time since the last mark to phase 'state'
+*/
+static void statsphase (global_State *g, int state) {
+  GCStats *st = g->gcstats;
+  l_mem now = luai_gcclock();
+  lua_Integer t = now - st->phasestart;
+  st->phasestart = now;
+  switch (state) {
+    case GCSpause: case GCSpropagate: st->cur.propagate += t; break;
+    case GCSatomic: st->cur.atomic += t; break;
+    case GCScallfin: st->cur.finalizers += t; break;
+    default: st->cur.sweep += t; break;  /* sweep states */
+  }
+}
+
+
+/*
+** a new cycle starts; the current one becomes the last finished cycle
+*/
+static void statscycle (global_State *g) {
+  GCStats *st = g->gcstats;
+  lua_Integer n = st->cur.cycles + 1;
+  st->last = st->cur;
+  st->last.cycles = n;
+  memset(&st->cur, 0, sizeof(st->cur));
+  st->cur.cycles = n;
+}
+
+
+static void statsbegin (global_State *g) {
+  GCStats *st = g->gcstats;
+  st->stepstart = st->phasestart = luai_gcclock();
+}
+
+
+/*
+** End of a step: charge what is left to phase 'state' and count the
+** step in the pause histogram.
+*/
+static void statsend (global_State *g, int state) {
+  GCStats *st = g->gcstats;
+  l_mem t;
+  int b = 0;
+  statsphase(g, state);
+  t = st->phasestart - st->stepstart;
+  while (t > 0 && b < LUA_GCSTATPAUSES - 1) {
+    t >>= 1;
+    b++;
+  }
+  st->cur.pauses[b]++;
+}
+
+
+void luaC_setstats (lua_State *L, int on) {
+  global_State *g = G(L);
+  if (on && g->gcstats == NULL) {
+    GCStats *st = luaM_new(L, GCStats);
+    memset(st, 0, sizeof(GCStats));
+    st->stepstart = st->phasestart = luai_gcclock();
+    g->gcstats = st;
+  }
+  else if (!on && g->gcstats != NULL) {
+    GCStats *st = g->gcstats;
+    g->gcstats = NULL;
+    luaM_free(L, st);
   }
 }
 
@@ -964,12 +1439,36 @@ static void entersweep (lua_State *L) {
 }
 
 
+/*
+** Release what the allocation function does not own, before it frees
+** all objects in list 'o' in bulk: the native code of prototypes
+*/
+static void freeforeign (lua_State *L, GCObject *o) {
+#if LUAJ_NATIVE
+  for (; o != NULL; o = o->next) {
+    if (o->tt == LUA_TPROTO && gco2p(o)->jit != NULL)
+      luaJ_freecode(L, gco2p(o));
+  }
+#else
+  UNUSED(L); UNUSED(o);
+#endif
+}
+
+
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  flushfinpend(L, g);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
-  callallpendingfinalizers(L);
+  callallpendingfinalizers(L, 0);
   lua_assert(g->tobefnz == NULL);
+  if (g->bulkfree) {  /* freeing the main block frees all objects? */
+    freeforeign(L, g->allgc);
+    freeforeign(L, g->fixedgc);
+    g->allgc = g->fixedgc = NULL;
+    g->strt.nuse = 0;
+    return;
+  }
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
@@ -984,6 +1483,7 @@ static l_mem atomic (lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;  /* will collect threads traversed from now on */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -997,6 +1497,7 @@ static l_mem atomic (lua_State *L) {
   propagateall(g);  /* propagate changes */
   work = g->GCmemtrav;  /* stop counting (do not recount 'grayagain') */
   g->gray = grayagain;
+  traversedirty(L, g);  /* traverse dirty parts of tables with cards */
   propagateall(g);  /* traverse 'grayagain' list */
   g->GCmemtrav = 0;  /* restart counting */
   convergeephemerons(g);
@@ -1006,6 +1507,7 @@ static l_mem atomic (lua_State *L) {
   clearvalues(g, g->allweak, NULL);
   origweak = g->weak; origall = g->allweak;
   work += g->GCmemtrav;  /* stop counting (objects being finalized) */
+  checkfinpend(g);  /* keep objects with finalizers still in 'allgc' */
   separatetobefnz(g, 0);  /* separate objects to be finalized */
   g->gcfinnum = 1;  /* there may be objects to be finalized */
   markbeingfnz(g);  /* mark objects that will be finalized */
@@ -1042,7 +1544,7 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
 }
 
 
-static lu_mem singlestep (lua_State *L) {
+static lu_mem dostep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
@@ -1097,6 +1599,28 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** performs one step of the current state (keeping statistics, when
+** they are on, at each change of state)
+*/
+static lu_mem singlestep (lua_State *L) {
+  global_State *g = G(L);
+  if (g->gcstats == NULL)  /* usual case */
+    return dostep(L);
+  else {
+    int state = g->gcstate;
+    lu_mem work;
+    if (state == GCSpause)
+      statscycle(g);
+    work = dostep(L);
+    /* (a finalizer may have turned statistics off) */
+    if (g->gcstats && g->gcstate != state)
+      statsphase(g, state);
+    return work;
+  }
+}
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
@@ -1108,6 +1632,174 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 }
 
 
+
+/*
+** {======================================================
+** Generational mode
+** =======================================================
+*/
+
+
+/*
+** Set the debt for the next young collection: it happens after the
+** heap grows 'gcminorinc'%.
+*/
+static void setminordebt (global_State *g) {
+  l_mem inc = cast(l_mem, gettotalbytes(g) / 100) * g->gcminorinc;
+  luaE_setdebt(g, -inc);
+}
+
+
+/*
+** Threads and weak tables stay gray between young collections: stacks
+** change without barriers, and weak tables must be cleared of young
+** objects by every collection. Gather them (the atomic phase left the
+** threads in 'grayagain' and the weak tables in the weak lists) so
+** that the next atomic phase traverses them again.
+*/
+static void keepgrays (global_State *g) {
+  GCObject *l[3];
+  int i;
+  l[0] = g->weak; l[1] = g->allweak; l[2] = g->ephemeron;
+  g->weak = g->allweak = g->ephemeron = NULL;
+  for (i = 0; i < 3; i++) {
+    while (l[i] != NULL) {
+      Table *h = gco2t(l[i]);
+      l[i] = h->gclist;
+      linkgclist(h, g->grayagain);
+    }
+  }
+}
+
+
+/*
+** Sweep the young objects of a list (generational mode), which are
+** always at its front: free the dead ones and make the others old,
+** keeping their colors (objects waiting to go to 'finobj' move there
+** still young). The first old object ends the sweep.
+*/
+static void sweepgen (lua_State *L, GCObject **p) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  GCObject *curr;
+  while ((curr = *p) != NULL && !isold(curr)) {
+    if (isdeadm(ow, curr->marked)) {  /* is 'curr' dead? */
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else if (testbit(curr->marked, FINPENDBIT)) {  /* go to 'finobj' */
+      resetbit(curr->marked, FINPENDBIT);  /* there it will become old */
+      *p = curr->next;
+      curr->next = g->finobj;
+      g->finobj = curr;
+    }
+    else {
+      l_setbit(curr->marked, OLDBIT);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
+
+/*
+** Young (minor) collection: marks from the objects grayed by barriers
+** plus the gray old objects in 'grayagain', then sweeps only the young
+** objects. Objects being finalized stay marked until their finalizers
+** run, so 'tobefnz' needs no sweep. Returns with the collector waiting
+** in the propagate phase.
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(isgenerational(g) && g->gcstate == GCSpropagate);
+  propagateall(g);
+  if (g->gcstats) statsphase(g, GCSpropagate);
+  atomic(L);
+  keepgrays(g);
+  if (g->gcstats) statsphase(g, GCSatomic);
+  g->gcstate = GCSswpallgc;  /* no barriers while freeing objects */
+  sweepgen(L, &g->allgc);
+  sweepgen(L, &g->finobj);
+  checkSizes(L, g);
+  if (g->gcstats) statsphase(g, GCSswpallgc);
+  g->gcstate = GCSpropagate;
+}
+
+
+/*
+** turn all objects in list 'p' into young white objects
+*/
+static void whitelist (global_State *g, GCObject *p) {
+  for (; p != NULL; p = p->next)
+    makewhite(g, p);
+}
+
+
+/*
+** Major collection in generational mode: make all objects young and
+** white again, restart the mark from the roots and run a young
+** collection, which then traverses and sweeps the whole heap. (As it
+** goes over the whole heap anyway, objects given finalizers late move
+** to 'finobj' first, so that their finalizers run now if they are dead.)
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  whitelist(g, g->allgc);
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  movefinpend(g);
+  makewhite(g, g->mainthread);
+  restartcollection(g);
+  youngcollection(L, g);
+  g->GCestimate = gettotalbytes(g);  /* base for next major collection */
+}
+
+
+/*
+** A step in generational mode is a whole collection: a major one if
+** the heap grew more than 'gcmajorinc'% since the last major
+** collection, a young one otherwise.
+*/
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;
+  lu_mem majorinc = (majorbase / 100) * g->gcmajorinc;
+  if (g->gcstats) statscycle(g);
+  if (gettotalbytes(g) > majorbase + majorinc)
+    fullgen(L, g);
+  else
+    youngcollection(L, g);
+  setminordebt(g);
+}
+
+
+/*
+** Change the collector mode. Entering generational mode finishes the
+** current cycle and runs a collection that makes all survivors old;
+** leaving it sweeps all objects back to white, which collects nothing
+** as the current white does not change.
+*/
+void luaC_changemode (lua_State *L, int mode) {
+  global_State *g = G(L);
+  if (mode == g->gckind) return;  /* nothing to change */
+  if (g->gcstats) statsbegin(g);
+  if (mode == KGC_GEN) {
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish current cycle */
+    luaC_runtilstate(L, bitmask(GCSpropagate));  /* start a new one */
+    g->gckind = KGC_GEN;
+    youngcollection(L, g);
+    g->GCestimate = gettotalbytes(g);
+    setminordebt(g);
+  }
+  else {
+    g->gckind = KGC_NORMAL;
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    g->GCestimate = gettotalbytes(g);
+    setpause(g);
+  }
+  if (g->gcstats) statsend(g, g->gcstate);
+}
+
+/* }====================================================== */
+
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1124,26 +1816,106 @@ static l_mem getdebt (global_State *g) {
 }
 
 /*
-** performs a basic GC step when collector is running
+** Perform single steps until doing 'maxwork' work units, finishing a
+** cycle, or spending 'us' microseconds. The clock is read only after
+** each quarter of the work expected to fit in 'us' (at the rate
+** measured by previous steps, 'gcrate'), so a step can overrun its
+** time by about that much plus one single step (or the whole atomic
+** phase). Returns the work done.
+*/
+static l_mem timedsteps (lua_State *L, l_mem maxwork, l_mem us) {
+  global_State *g = G(L);
+  l_mem start = luai_gcclock();
+  l_mem quantum = g->gcrate * (us / 4 + 1);
+  l_mem check = quantum;
+  l_mem done = 0;
+  l_mem elapsed;
+  do {
+    done += singlestep(L);
+    if (done >= check) {
+      if (luai_gcclock() - start >= us)
+        break;  /* out of time */
+      check = done + quantum;
+    }
+  } while (done < maxwork && g->gcstate != GCSpause);
+  elapsed = luai_gcclock() - start;
+  if (elapsed > 0)  /* clock advanced? update rate */
+    g->gcrate = (g->gcrate + done / elapsed) / 2 + 1;
+  return done;
+}
+
+
+/*
+** Run the collector for about 'us' microseconds, whatever its debt
+** (for hosts that collect in idle time). The work done is credited to
+** the debt. In generational mode, run a young collection. Return
+** true if a cycle finished.
+*/
+int luaC_steptime (lua_State *L, l_mem us) {
+  global_State *g = G(L);
+  int finished;
+  if (g->gcstats) statsbegin(g);
+  if (isgenerational(g)) {
+    genstep(L, g);
+    callallpendingfinalizers(L, 1);
+    finished = 1;
+  }
+  else {
+    l_mem work = timedsteps(L, MAX_LMEM, us);
+    finished = (g->gcstate == GCSpause);
+    if (finished)
+      setpause(g);
+    else
+      luaE_setdebt(g, g->GCdebt - (work / g->gcstepmul) * STEPMULADJ);
+  }
+  if (g->gcstats) statsend(g, isgenerational(g) ? GCScallfin : g->gcstate);
+  return finished;
+}
+
+
+/*
+** performs a basic GC step when collector is running (if 'gcstepus'
+** is set, spending at most about that time)
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  int endstate;  /* phase charged with the end of the step */
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
-  do {  /* repeat until pause or enough "credit" (negative debt) */
-    lu_mem work = singlestep(L);  /* perform one single step */
-    debt -= work;
-  } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
+  if (g->gcstats) statsbegin(g);
+  if (isgenerational(g)) {
+    genstep(L, g);
+    callallpendingfinalizers(L, 1);
+    if (g->gcstats) statsend(g, GCScallfin);
+    return;
+  }
+  if (g->gcstepus > 0) {  /* time target for steps? */
+    debt -= timedsteps(L, debt + GCSTEPSIZE, g->gcstepus);
+    if (debt > -GCSTEPSIZE)  /* out of time before paying the debt? */
+      debt = -GCSTEPSIZE;  /* let the program run a little anyway */
+  }
+  else {
+    do {  /* repeat until pause or enough "credit" (negative debt) */
+      lu_mem work = singlestep(L);  /* perform one single step */
+      debt -= work;
+    } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
+  }
+  endstate = g->gcstate;
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else {
     debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
+    if (g->gcstats && g->tobefnz) {  /* charge finalizers apart */
+      statsphase(g, g->gcstate);
+      endstate = GCScallfin;
+    }
     runafewfinalizers(L);
   }
+  if (g->gcstats) statsend(g, endstate);
 }
 
 
@@ -1154,24 +1926,44 @@ void luaC_step (lua_State *L) {
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** changed, nothing will be collected). In generational mode, a regular
+** full collection is a major collection.
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
+  int origkind = g->gckind;
+  lua_assert(origkind != KGC_EMERGENCY);
+  if (g->gcstats) statsbegin(g);
+  if (origkind == KGC_GEN && !isemergency) {
+    if (g->gcstats) statscycle(g);
+    fullgen(L, g);
+    setminordebt(g);
+    callallpendingfinalizers(L, 1);
+    if (g->gcstats) statsend(g, GCScallfin);
+    return;
+  }
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
+  if (origkind != KGC_GEN)  /* (old objects cannot move in that mode) */
+    movefinpend(g);  /* finalize dead objects given finalizers late, too */
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
-  setpause(g);
+  g->gckind = origkind;
+  if (origkind == KGC_GEN) {  /* emergency in generational mode? */
+    /* generational mode must wait in the propagate phase */
+    luaC_runtilstate(L, bitmask(GCSpropagate));
+    setminordebt(g);
+  }
+  else
+    setpause(g);
+  if (g->gcstats) statsend(g, g->gcstate);
 }
 
 /* }====================================================== */
@@ -61,6 +61,22 @@
 #define keepinvariant(g)	((g)->gcstate <= GCSatomic)
 
 
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
+
+/*
+** Statistics kept while LUA_GCSETSTATS is on: 'cur' accumulates the
+** cycle in progress, which starts when the collector restarts marking
+** and lasts until it restarts again.
+*/
+typedef struct GCStats {
+  lua_GCStats cur;  /* cycle in progress */
+  lua_GCStats last;  /* last finished cycle */
+  l_mem stepstart;  /* clock when the current step began */
+  l_mem phasestart;  /* clock when the current phase (in this step) began */
+} GCStats;
+
+
 /*
 ** some useful bit tricks
 */
@@ -79,6 +95,8 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		4  /* object is old (only in generational mode) */
+#define FINPENDBIT	5  /* object with finalizer still in 'allgc' list */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +109,12 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+
+/* MOVE OLD rule: whenever an object is moved to the beginning of
+   a GC list, its old bit must be cleared */
+#define resetoldbit(o)	resetbit((o)->marked, OLDBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -123,6 +147,15 @@
 	(iscollectable(v) && isblack(p) && iswhite(gcvalue(v))) ? \
 	luaC_barrierback_(L,p) : cast_void(0))
 
+/* back barrier for an assignment through 'slot' (a value or key of 'p') */
+#define luaC_barrierslot(L,p,s,v) (  \
+	(iscollectable(v) && isblack(p) && iswhite(gcvalue(v))) ? \
+	luaC_barrierslot_(L,p,s) : cast_void(0))
+
+/* entries of table 't' may have moved */
+#define luaC_tablemoved(t)  \
+	((t)->cards != NULL ? luaC_tablemoved_(t) : cast_void(0))
+
 #define luaC_objbarrier(L,p,o) (  \
 	(isblack(p) && iswhite(o)) ? \
 	luaC_barrier_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
@@ -134,11 +167,17 @@
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_steptime (lua_State *L, l_mem us);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int mode);
+LUAI_FUNC void luaC_setstats (lua_State *L, int on);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
+LUAI_FUNC void luaC_barrierslot_ (lua_State *L, Table *t,
+                                  const TValue *slot);
+LUAI_FUNC void luaC_tablemoved_ (Table *t);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
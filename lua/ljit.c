@@ -0,0 +1,1161 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to native code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ljit.h"
+
+
+#if LUAJ_NATIVE
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lopcodes.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** The compiler translates each instruction of a hot prototype into a
+** fixed template of x86-64 code. Templates handle the common cases
+** inline (integer and float arithmetic, comparisons, numeric loops)
+** or through small C helpers that never raise errors nor reallocate
+** the stack (table accesses). Anything else, including every case
+** that could run a metamethod, allocate memory, or call a function,
+** leaves the native code through an "exit stub" that stores the pc of
+** the pending instruction in 'savedpc' and returns to the interpreter,
+** which executes that instruction as usual. The interpreter enters
+** native code again at the next call or backward jump.
+**
+** There is native code for every instruction, so execution can enter
+** a compiled prototype at any pc. While running native code, these
+** registers are fixed:
+**   rbx: 'base'; r12: constant table 'k'; r13: 'L'; r14: 'ci';
+**   r15: the running closure.
+*/
+
+
+/* registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RBP	5
+#define RSI	6
+#define RDI	7
+#define R8	8
+#define R12	12
+#define R13	13
+#define R14	14
+#define R15	15
+
+#define XMM0	0
+#define XMM1	1
+
+#define RBASE	RBX
+#define RKST	R12
+#define RSTATE	R13
+#define RCI	R14
+#define RCLOSURE	R15
+
+
+/* condition codes */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_A	0x7
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	(-1)
+
+
+/* opcodes (two-byte opcodes have the 0x0F escape in the high byte) */
+#define X_MOVRM		0x8B	/* mov r, r/m */
+#define X_MOVMR		0x89	/* mov r/m, r */
+#define X_ADD		0x03
+#define X_SUB		0x2B
+#define X_AND		0x23
+#define X_OR		0x0B
+#define X_XOR		0x33
+#define X_CMP		0x3B
+#define X_IMUL		0x0FAF
+#define X_LEA		0x8D
+#define X_MOVSD		0x0F10	/* with prefix 0xF2 */
+#define X_MOVSDST	0x0F11	/* with prefix 0xF2 */
+#define X_ADDSD		0x0F58	/* with prefix 0xF2 */
+#define X_MULSD		0x0F59	/* with prefix 0xF2 */
+#define X_SUBSD		0x0F5C	/* with prefix 0xF2 */
+#define X_DIVSD		0x0F5E	/* with prefix 0xF2 */
+#define X_CVTSI2SD	0x0F2A	/* with prefix 0xF2 */
+#define X_UCOMISD	0x0F2E	/* with prefix 0x66 */
+
+
+/* size of each exit stub */
+#define STUBSIZE	16
+
+/* offset of a register (or constant) in the stack (or constant table) */
+#define slot(r)		(cast_int(r) * cast_int(sizeof(TValue)))
+
+/* offset of the tag in a TValue */
+#define TT	cast_int(offsetof(TValue, tt_))
+
+
+typedef struct JitState {
+  lu_byte *mc;  /* machine-code block (NULL while measuring) */
+  size_t pos;  /* current offset in 'mc' */
+  unsigned int *entry;  /* offset of the code of each instruction */
+  size_t exitcode;  /* offset of common exit sequence */
+  size_t stubs;  /* offset of first exit stub */
+  Proto *p;  /* prototype being compiled */
+  int pc;  /* instruction being compiled */
+} JitState;
+
+
+/* an operand: memory at [b + d], with known tag 'tt' (-1 if unknown) */
+typedef struct Opnd {
+  int b;
+  int d;
+  int tt;
+} Opnd;
+
+
+/* a forward label */
+typedef struct Label {
+  size_t ref[4];  /* offsets right after each pending jump */
+  int n;
+} Label;
+
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+static void eb (JitState *J, int b) {
+  if (J->mc) J->mc[J->pos] = cast_byte(b);
+  J->pos++;
+}
+
+
+static void e32 (JitState *J, int x) {
+  unsigned int u = cast(unsigned int, x);
+  eb(J, u & 0xff); eb(J, (u >> 8) & 0xff);
+  eb(J, (u >> 16) & 0xff); eb(J, (u >> 24) & 0xff);
+}
+
+
+static void e64 (JitState *J, size_t x) {
+  int i;
+  for (i = 0; i < 8; i++) {
+    eb(J, cast_int(x & 0xff));
+    x >>= 8;
+  }
+}
+
+
+static void rex (JitState *J, int w, int r, int b) {
+  int x = (w << 3) | ((r & 8) >> 1) | ((b & 8) >> 3);
+  if (x) eb(J, 0x40 | x);
+}
+
+
+static void opcode (JitState *J, int pfx, int w, int op, int r, int b) {
+  if (pfx) eb(J, pfx);
+  rex(J, w, r, b);
+  if (op > 0xff) eb(J, op >> 8);
+  eb(J, op & 0xff);
+}
+
+
+/* instruction 'op' with a register 'r' and memory operand [b + d] */
+static void opm (JitState *J, int pfx, int w, int op, int r, int b, int d) {
+  opcode(J, pfx, w, op, r, b);
+  eb(J, 0x80 | ((r & 7) << 3) | (b & 7));  /* mod = 10: [b + disp32] */
+  if ((b & 7) == RSP) eb(J, 0x24);  /* SIB needed for rsp/r12 */
+  e32(J, d);
+}
+
+
+/* instruction 'op' with two register operands */
+static void opr (JitState *J, int pfx, int w, int op, int r, int b) {
+  opcode(J, pfx, w, op, r, b);
+  eb(J, 0xC0 | ((r & 7) << 3) | (b & 7));
+}
+
+
+/* mov dword [b + d], imm */
+static void movmi (JitState *J, int b, int d, int imm) {
+  opm(J, 0, 0, 0xC7, 0, b, d);
+  e32(J, imm);
+}
+
+
+/* cmp dword [b + d], imm */
+static void cmpmi (JitState *J, int b, int d, int imm) {
+  opm(J, 0, 0, 0x81, 7, b, d);
+  e32(J, imm);
+}
+
+
+/* mov r, imm64 */
+static void movri (JitState *J, int r, size_t imm) {
+  rex(J, 1, 0, r);
+  eb(J, 0xB8 + (r & 7));
+  e64(J, imm);
+}
+
+
+static void push (JitState *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x50 + (r & 7));
+}
+
+
+static void pop (JitState *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x58 + (r & 7));
+}
+
+
+/* jump (conditional unless 'cc' is CC_ALWAYS) to offset 'target' */
+static void jmpto (JitState *J, int cc, size_t target) {
+  if (cc == CC_ALWAYS) eb(J, 0xE9);
+  else { eb(J, 0x0F); eb(J, 0x80 + cc); }
+  e32(J, cast_int(target - (J->pos + 4)));
+}
+
+
+/* jump to a forward label */
+static void jlabel (JitState *J, int cc, Label *l) {
+  jmpto(J, cc, J->pos);  /* displacement fixed by 'bind' */
+  lua_assert(l->n < 4);
+  l->ref[l->n++] = J->pos;
+}
+
+
+/* bind label 'l' to the current position */
+static void bind (JitState *J, Label *l) {
+  int i;
+  for (i = 0; i < l->n; i++) {
+    size_t ref = l->ref[i];
+    if (J->mc) {
+      unsigned int u = cast(unsigned int, cast_int(J->pos - ref));
+      J->mc[ref - 4] = cast_byte(u & 0xff);
+      J->mc[ref - 3] = cast_byte((u >> 8) & 0xff);
+      J->mc[ref - 2] = cast_byte((u >> 16) & 0xff);
+      J->mc[ref - 1] = cast_byte((u >> 24) & 0xff);
+    }
+  }
+  l->n = 0;
+}
+
+
+/* call C function 'f' (arguments already in place) */
+static void callc (JitState *J, void (*f) (void)) {
+  movri(J, RAX, cast(size_t, f));
+  eb(J, 0xFF); eb(J, 0xD0);  /* call rax */
+}
+
+#define callhelper(J,f)		callc(J, cast(void (*) (void), f))
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Helpers called from native code; none of them can raise errors
+** or reallocate the stack. Those returning an 'int' return 0 when the
+** interpreter must handle the instruction.
+** =======================================================
+*/
+
+static int jit_gettable (lua_State *L, const TValue *t, const TValue *key,
+                         StkId ra) {
+  if (ttistable(t)) {
+    Table *h = hvalue(t);
+    const TValue *slot = luaH_get(h, key);
+    if (!ttisnil(slot) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+      setobj2s(L, ra, slot);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static int jit_getfield (lua_State *L, const TValue *t, TString *key,
+                         StkId ra, unsigned int *hint) {
+  if (ttistable(t)) {
+    Table *h = hvalue(t);
+    const TValue *slot = luaH_getcached(h, key, hint);
+    if (!ttisnil(slot) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+      setobj2s(L, ra, slot);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** (Assignments that would unpack a packed array part allocate memory,
+** so they are left to the interpreter.)
+*/
+static int jit_settable (lua_State *L, const TValue *t, const TValue *key,
+                         const TValue *v) {
+  Table *h;
+  const TValue *slot;
+  if (!ttistable(t))
+    return 0;
+  h = hvalue(t);
+  slot = luaH_get(h, key);
+  if (ttisnil(slot))
+    return 0;
+  luaV_checkwatch(L, key);
+  if (ispacked(h) && slot == &gpacked(h)->slot)
+    return luaH_trysetpacked(h, v);  /* (numbers need no barrier) */
+  luaC_barrierslot(L, h, slot, v);
+  setobj2t(L, cast(TValue *, slot), v);
+  return 1;
+}
+
+
+static int jit_setfield (lua_State *L, const TValue *t, TString *key,
+                         const TValue *v, unsigned int *hint) {
+  if (iswatched(key))  /* key of hoisted lookups? */
+    G(L)->hoistepoch++;
+  if (ttistable(t)) {
+    const TValue *slot = luaH_getcached(hvalue(t), key, hint);
+    if (!ttisnil(slot)) {
+      luaC_barrierslot(L, hvalue(t), slot, v);
+      setobj2t(L, cast(TValue *, slot), v);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static void jit_setupval (lua_State *L, UpVal *uv, const TValue *v) {
+  if (ttistable(uv->v))  /* may hold tables of hoisted lookups */
+    G(L)->hoistepoch++;
+  setobj(L, uv->v, v);
+  luaC_upvalbarrier(L, uv);
+}
+
+
+static int jit_len (lua_State *L, const TValue *rb, StkId ra) {
+  if (ttistable(rb)) {
+    Table *h = hvalue(rb);
+    if (fasttm(L, h->metatable, TM_LEN) != NULL)
+      return 0;
+    setivalue(ra, luaH_getn(h));
+  }
+  else if (ttisshrstring(rb)) {
+    setivalue(ra, tsvalue(rb)->shrlen);
+  }
+  else if (ttislngstring(rb)) {
+    setivalue(ra, tsvalue(rb)->u.lnglen);
+  }
+  else return 0;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/* offset of the code of instruction 'pc' */
+#define entrypos(J,pc)	((J)->entry[pc])
+
+/* offset of the exit stub of instruction 'pc' */
+#define exitpos(J,pc)	((J)->stubs + cast(size_t, pc) * STUBSIZE)
+
+#define NOLABEL		{{0, 0, 0, 0}, 0}
+
+
+static Opnd reg (int r) {
+  Opnd o;
+  o.b = RBASE; o.d = slot(r); o.tt = -1;
+  return o;
+}
+
+
+static Opnd rk (JitState *J, int x) {
+  if (ISK(x)) {
+    Opnd o;
+    o.b = RKST; o.d = slot(INDEXK(x)); o.tt = rttype(&J->p->k[INDEXK(x)]);
+    return o;
+  }
+  else return reg(x);
+}
+
+
+#define isKstr(J,x)	(ISK(x) && ttisshrstring(&(J)->p->k[INDEXK(x)]))
+#define Kstr(J,x)	tsvalue(&(J)->p->k[INDEXK(x)])
+
+
+/* jump to label 'l' (or to the exit of the current instruction) */
+static void jfail (JitState *J, int cc, Label *l) {
+  if (l) jlabel(J, cc, l);
+  else jmpto(J, cc, exitpos(J, J->pc));
+}
+
+
+/* go to 'l' unless operand 'o' has tag 'tt' */
+static void guardtag (JitState *J, Opnd o, int tt, Label *l) {
+  if (o.tt == -1) {
+    cmpmi(J, o.b, o.d + TT, tt);
+    jfail(J, CC_NE, l);
+  }
+  else if (o.tt != tt)
+    jfail(J, CC_ALWAYS, l);
+}
+
+
+#define mayint(o)	((o).tt == -1 || (o).tt == LUA_TNUMINT)
+
+
+static void copytv (JitState *J, Opnd src, int b, int d) {
+  opm(J, 0, 1, X_MOVRM, RAX, src.b, src.d);
+  opm(J, 0, 1, X_MOVRM, RCX, src.b, src.d + TT);
+  opm(J, 0, 1, X_MOVMR, RAX, b, d);
+  opm(J, 0, 1, X_MOVMR, RCX, b, d + TT);
+}
+
+
+/* load number operand 'o' as a float into 'x'; exit if not a number */
+static void loadnum (JitState *J, int x, Opnd o) {
+  if (o.tt == LUA_TNUMFLT)
+    opm(J, 0xF2, 0, X_MOVSD, x, o.b, o.d);
+  else if (o.tt == LUA_TNUMINT)
+    opm(J, 0xF2, 1, X_CVTSI2SD, x, o.b, o.d);
+  else if (o.tt != -1)
+    jfail(J, CC_ALWAYS, NULL);
+  else {
+    Label isint = NOLABEL, done = NOLABEL;
+    cmpmi(J, o.b, o.d + TT, LUA_TNUMFLT);
+    jlabel(J, CC_NE, &isint);
+    opm(J, 0xF2, 0, X_MOVSD, x, o.b, o.d);
+    jlabel(J, CC_ALWAYS, &done);
+    bind(J, &isint);
+    cmpmi(J, o.b, o.d + TT, LUA_TNUMINT);
+    jfail(J, CC_NE, NULL);
+    opm(J, 0xF2, 1, X_CVTSI2SD, x, o.b, o.d);
+    bind(J, &done);
+  }
+}
+
+
+/* exit to the interpreter at instruction 'target' if there are hooks */
+static void hookcheck (JitState *J, int target) {
+  opm(J, 0, 0, 0xF7, 0, RSTATE, cast_int(offsetof(lua_State, hookmask)));
+  e32(J, LUA_MASKLINE | LUA_MASKCOUNT);  /* test dword [L->hookmask] */
+  jmpto(J, CC_NE, exitpos(J, target));
+}
+
+
+/* jump to instruction 'target' */
+static void jumppc (JitState *J, int cc, int target) {
+  jmpto(J, cc, entrypos(J, target));
+}
+
+
+/* go to 'lf' if operand 'o' is false; fall through otherwise */
+static void truth (JitState *J, Opnd o, Label *lf) {
+  Label lt = NOLABEL;
+  cmpmi(J, o.b, o.d + TT, LUA_TNIL);
+  jlabel(J, CC_E, lf);
+  cmpmi(J, o.b, o.d + TT, LUA_TBOOLEAN);
+  jlabel(J, CC_NE, &lt);
+  cmpmi(J, o.b, o.d, 0);
+  jlabel(J, CC_E, lf);
+  bind(J, &lt);
+}
+
+
+static void arith (JitState *J, OpCode op, Instruction i) {
+  int ra = slot(GETARG_A(i));
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  Label flt = NOLABEL, done = NOLABEL;
+  int fop;
+  if (op != OP_DIV && mayint(b) && mayint(c)) {  /* integer case */
+    guardtag(J, b, LUA_TNUMINT, &flt);
+    guardtag(J, c, LUA_TNUMINT, &flt);
+    opm(J, 0, 1, X_MOVRM, RAX, b.b, b.d);
+    opm(J, 0, 1, (op == OP_ADD) ? X_ADD : (op == OP_SUB) ? X_SUB : X_IMUL,
+               RAX, c.b, c.d);
+    opm(J, 0, 1, X_MOVMR, RAX, RBASE, ra);
+    movmi(J, RBASE, ra + TT, LUA_TNUMINT);
+    jlabel(J, CC_ALWAYS, &done);
+    bind(J, &flt);
+  }
+  switch (op) {
+    case OP_ADD: fop = X_ADDSD; break;
+    case OP_SUB: fop = X_SUBSD; break;
+    case OP_MUL: fop = X_MULSD; break;
+    default: lua_assert(op == OP_DIV); fop = X_DIVSD; break;
+  }
+  loadnum(J, XMM0, b);
+  loadnum(J, XMM1, c);
+  opr(J, 0xF2, 0, fop, XMM0, XMM1);
+  opm(J, 0xF2, 0, X_MOVSDST, XMM0, RBASE, ra);
+  movmi(J, RBASE, ra + TT, LUA_TNUMFLT);
+  bind(J, &done);
+}
+
+
+static void bitwise (JitState *J, OpCode op, Instruction i) {
+  int ra = slot(GETARG_A(i));
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  guardtag(J, b, LUA_TNUMINT, NULL);
+  guardtag(J, c, LUA_TNUMINT, NULL);
+  opm(J, 0, 1, X_MOVRM, RAX, b.b, b.d);
+  opm(J, 0, 1, (op == OP_BAND) ? X_AND : (op == OP_BOR) ? X_OR : X_XOR,
+             RAX, c.b, c.d);
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, ra);
+  movmi(J, RBASE, ra + TT, LUA_TNUMINT);
+}
+
+
+static void unm (JitState *J, Instruction i) {
+  int ra = slot(GETARG_A(i));
+  Opnd b = reg(GETARG_B(i));
+  Label flt = NOLABEL, done = NOLABEL;
+  guardtag(J, b, LUA_TNUMINT, &flt);
+  opm(J, 0, 1, X_MOVRM, RAX, b.b, b.d);
+  opr(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, ra);
+  movmi(J, RBASE, ra + TT, LUA_TNUMINT);
+  jlabel(J, CC_ALWAYS, &done);
+  bind(J, &flt);
+  guardtag(J, b, LUA_TNUMFLT, NULL);
+  opm(J, 0, 1, X_MOVRM, RAX, b.b, b.d);
+  opr(J, 0, 1, 0x0FBA, 7, RAX); eb(J, 63);  /* btc rax, 63 (flip sign) */
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, ra);
+  movmi(J, RBASE, ra + TT, LUA_TNUMFLT);
+  bind(J, &done);
+}
+
+
+static void opnot (JitState *J, Instruction i) {
+  int ra = slot(GETARG_A(i));
+  Label lf = NOLABEL, done = NOLABEL;
+  truth(J, reg(GETARG_B(i)), &lf);
+  eb(J, 0xB8); e32(J, 0);  /* mov eax, 0 */
+  jlabel(J, CC_ALWAYS, &done);
+  bind(J, &lf);
+  eb(J, 0xB8); e32(J, 1);  /* mov eax, 1 */
+  bind(J, &done);
+  opm(J, 0, 0, X_MOVMR, RAX, RBASE, ra);
+  movmi(J, RBASE, ra + TT, LUA_TBOOLEAN);
+}
+
+
+/*
+** Equality against a constant; the result does not depend on
+** metamethods, as values of different types are never equal (except
+** numbers, which go to the interpreter when types are mixed).
+*/
+static void eqk (JitState *J, Opnd o, Opnd k, int jt, int jf) {
+  switch (k.tt) {
+    case LUA_TNIL: {
+      cmpmi(J, o.b, o.d + TT, LUA_TNIL);
+      jumppc(J, CC_E, jt);
+      break;
+    }
+    case LUA_TBOOLEAN: {
+      cmpmi(J, o.b, o.d + TT, LUA_TBOOLEAN);
+      jumppc(J, CC_NE, jf);
+      opm(J, 0, 0, X_MOVRM, RAX, k.b, k.d);
+      opm(J, 0, 0, X_CMP, RAX, o.b, o.d);
+      jumppc(J, CC_E, jt);
+      break;
+    }
+    case LUA_TSHRSTR | BIT_ISCOLLECTABLE: {
+      cmpmi(J, o.b, o.d + TT, k.tt);
+      jumppc(J, CC_NE, jf);
+      opm(J, 0, 1, X_MOVRM, RAX, k.b, k.d);
+      opm(J, 0, 1, X_CMP, RAX, o.b, o.d);
+      jumppc(J, CC_E, jt);
+      break;
+    }
+    case LUA_TNUMINT: case LUA_TNUMFLT: {
+      int other = (k.tt == LUA_TNUMINT) ? LUA_TNUMFLT : LUA_TNUMINT;
+      Label same = NOLABEL;
+      cmpmi(J, o.b, o.d + TT, k.tt);
+      jlabel(J, CC_E, &same);
+      cmpmi(J, o.b, o.d + TT, other);
+      jfail(J, CC_E, NULL);  /* mixed numbers */
+      jumppc(J, CC_ALWAYS, jf);
+      bind(J, &same);
+      if (k.tt == LUA_TNUMINT) {
+        opm(J, 0, 1, X_MOVRM, RAX, k.b, k.d);
+        opm(J, 0, 1, X_CMP, RAX, o.b, o.d);
+      }
+      else {
+        opm(J, 0xF2, 0, X_MOVSD, XMM0, k.b, k.d);
+        opm(J, 0x66, 0, X_UCOMISD, XMM0, o.b, o.d);
+        jumppc(J, CC_P, jf);  /* NaN */
+      }
+      jumppc(J, CC_E, jt);
+      break;
+    }
+    default: {  /* long strings */
+      jfail(J, CC_ALWAYS, NULL);
+      return;
+    }
+  }
+  jumppc(J, CC_ALWAYS, jf);
+}
+
+
+static void compare (JitState *J, OpCode op, Instruction i) {
+  Opnd b = rk(J, GETARG_B(i));
+  Opnd c = rk(J, GETARG_C(i));
+  int jt = J->pc + (GETARG_A(i) ? 1 : 2);  /* where to go if true */
+  int jf = J->pc + (GETARG_A(i) ? 2 : 1);  /* where to go if false */
+  Label flt = NOLABEL;
+  if (op == OP_EQ && (b.tt != -1 || c.tt != -1)) {
+    if (b.tt == -1) eqk(J, b, c, jt, jf);
+    else if (c.tt == -1) eqk(J, c, b, jt, jf);
+    else jfail(J, CC_ALWAYS, NULL);  /* two constants */
+    return;
+  }
+  if (mayint(b) && mayint(c)) {  /* integer case */
+    guardtag(J, b, LUA_TNUMINT, &flt);
+    guardtag(J, c, LUA_TNUMINT, &flt);
+    opm(J, 0, 1, X_MOVRM, RAX, b.b, b.d);
+    opm(J, 0, 1, X_CMP, RAX, c.b, c.d);
+    jumppc(J, (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE, jt);
+    jumppc(J, CC_ALWAYS, jf);
+    bind(J, &flt);
+  }
+  guardtag(J, b, LUA_TNUMFLT, NULL);
+  guardtag(J, c, LUA_TNUMFLT, NULL);
+  opm(J, 0xF2, 0, X_MOVSD, XMM0, b.b, b.d);
+  opm(J, 0xF2, 0, X_MOVSD, XMM1, c.b, c.d);
+  if (op == OP_EQ) {
+    opr(J, 0x66, 0, X_UCOMISD, XMM0, XMM1);
+    jumppc(J, CC_P, jf);  /* NaN */
+    jumppc(J, CC_E, jt);
+  }
+  else {  /* unordered operands set CF, so that 'a' and 'ae' are false */
+    opr(J, 0x66, 0, X_UCOMISD, XMM1, XMM0);
+    jumppc(J, (op == OP_LT) ? CC_A : CC_AE, jt);
+  }
+  jumppc(J, CC_ALWAYS, jf);
+}
+
+
+static void test (JitState *J, Instruction i) {
+  Label lf = NOLABEL;
+  int c = GETARG_C(i);
+  truth(J, reg(GETARG_A(i)), &lf);
+  jumppc(J, CC_ALWAYS, J->pc + (c ? 1 : 2));
+  bind(J, &lf);
+  jumppc(J, CC_ALWAYS, J->pc + (c ? 2 : 1));
+}
+
+
+static void testset (JitState *J, Instruction i) {
+  Label lf = NOLABEL;
+  int c = GETARG_C(i);
+  int ra = slot(GETARG_A(i));
+  Opnd b = reg(GETARG_B(i));
+  truth(J, b, &lf);
+  if (c) { copytv(J, b, RBASE, ra); jumppc(J, CC_ALWAYS, J->pc + 1); }
+  else jumppc(J, CC_ALWAYS, J->pc + 2);
+  bind(J, &lf);
+  if (c) jumppc(J, CC_ALWAYS, J->pc + 2);
+  else { copytv(J, b, RBASE, ra); jumppc(J, CC_ALWAYS, J->pc + 1); }
+}
+
+
+static void jump (JitState *J, Instruction i) {
+  int target = J->pc + 1 + GETARG_sBx(i);
+  if (GETARG_A(i) != 0) {  /* close upvalues */
+    opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+    opm(J, 0, 1, X_LEA, RSI, RBASE, slot(GETARG_A(i) - 1));
+    callhelper(J, luaF_close);
+  }
+  if (target <= J->pc)
+    hookcheck(J, target);
+  jumppc(J, CC_ALWAYS, target);
+}
+
+
+static void forprep (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  guardtag(J, reg(a), LUA_TNUMINT, NULL);
+  guardtag(J, reg(a + 1), LUA_TNUMINT, NULL);
+  guardtag(J, reg(a + 2), LUA_TNUMINT, NULL);
+  opm(J, 0, 1, X_MOVRM, RAX, RBASE, slot(a));
+  opm(J, 0, 1, X_SUB, RAX, RBASE, slot(a + 2));
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, slot(a));
+  jumppc(J, CC_ALWAYS, J->pc + 1 + GETARG_sBx(i));
+}
+
+
+/* only integer loops; float loops go to the interpreter */
+static void forloop (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  int target = J->pc + 1 + GETARG_sBx(i);
+  Label neg = NOLABEL, cont = NOLABEL, done = NOLABEL;
+  guardtag(J, reg(a), LUA_TNUMINT, NULL);
+  opm(J, 0, 1, X_MOVRM, RAX, RBASE, slot(a));
+  opm(J, 0, 1, X_ADD, RAX, RBASE, slot(a + 2));  /* idx += step */
+  opm(J, 0, 1, X_MOVRM, RCX, RBASE, slot(a + 1));  /* limit */
+  opm(J, 0, 1, 0x81, 7, RBASE, slot(a + 2)); e32(J, 0);  /* cmp step, 0 */
+  jlabel(J, CC_LE, &neg);
+  opr(J, 0, 1, X_CMP, RAX, RCX);
+  jlabel(J, CC_G, &done);  /* idx > limit */
+  jlabel(J, CC_ALWAYS, &cont);
+  bind(J, &neg);
+  opr(J, 0, 1, X_CMP, RCX, RAX);
+  jlabel(J, CC_G, &done);  /* limit > idx */
+  bind(J, &cont);
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, slot(a));
+  opm(J, 0, 1, X_MOVMR, RAX, RBASE, slot(a + 3));
+  movmi(J, RBASE, slot(a + 3) + TT, LUA_TNUMINT);
+  hookcheck(J, target);
+  jumppc(J, CC_ALWAYS, target);
+  bind(J, &done);
+}
+
+
+static void tforloop (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  int target = J->pc + 1 + GETARG_sBx(i);
+  Label done = NOLABEL;
+  cmpmi(J, RBASE, slot(a + 1) + TT, LUA_TNIL);
+  jlabel(J, CC_E, &done);
+  copytv(J, reg(a + 1), RBASE, slot(a));
+  hookcheck(J, target);
+  jumppc(J, CC_ALWAYS, target);
+  bind(J, &done);
+}
+
+
+/* load in 'r' the address of the value of upvalue 'n' */
+static void upvaladdr (JitState *J, int r, int n) {
+  opm(J, 0, 1, X_MOVRM, r, RCLOSURE,
+      cast_int(offsetof(LClosure, upvals) + n * sizeof(UpVal *)));
+  opm(J, 0, 1, X_MOVRM, r, r, cast_int(offsetof(UpVal, v)));
+}
+
+
+/* load in 'r' the address of operand 'o' */
+static void opndaddr (JitState *J, int r, Opnd o) {
+  opm(J, 0, 1, X_LEA, r, o.b, o.d);
+}
+
+
+/* call a helper that returns 0 to ask for the interpreter */
+static void callcheck (JitState *J, void (*f) (void)) {
+  callc(J, f);
+  eb(J, 0x85); eb(J, 0xC0);  /* test eax, eax */
+  jfail(J, CC_E, NULL);
+}
+
+#define callhelpercheck(J,f)	callcheck(J, cast(void (*) (void), f))
+
+
+/*
+** table read: 'rsi' has the table; key is RK(c); result goes to
+** register 'a'
+*/
+static void gettable (JitState *J, int a, int c) {
+  opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+  opm(J, 0, 1, X_LEA, RCX, RBASE, slot(a));
+  if (isKstr(J, c)) {
+    movri(J, RDX, cast(size_t, Kstr(J, c)));
+    movri(J, R8, cast(size_t, J->p->icache + J->pc));
+    callhelpercheck(J, jit_getfield);
+  }
+  else {
+    opndaddr(J, RDX, rk(J, c));
+    callhelpercheck(J, jit_gettable);
+  }
+}
+
+
+/* table write: 'rsi' has the table; key is RK(b); value is RK(c) */
+static void settable (JitState *J, int b, int c) {
+  opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+  opndaddr(J, RCX, rk(J, c));
+  if (isKstr(J, b)) {
+    movri(J, RDX, cast(size_t, Kstr(J, b)));
+    movri(J, R8, cast(size_t, J->p->icache + J->pc));
+    callhelpercheck(J, jit_setfield);
+  }
+  else {
+    opndaddr(J, RDX, rk(J, b));
+    callhelpercheck(J, jit_settable);
+  }
+}
+
+
+static void instruction (JitState *J, Instruction i) {
+  OpCode op = GET_BASEOPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_MOVE: {
+      copytv(J, reg(GETARG_B(i)), RBASE, slot(a));
+      break;
+    }
+    case OP_LOADK: {
+      Opnd k;
+      k.b = RKST; k.d = slot(GETARG_Bx(i)); k.tt = -1;
+      copytv(J, k, RBASE, slot(a));
+      break;
+    }
+    case OP_LOADBOOL: {
+      movmi(J, RBASE, slot(a), GETARG_B(i));
+      movmi(J, RBASE, slot(a) + TT, LUA_TBOOLEAN);
+      if (GETARG_C(i)) jumppc(J, CC_ALWAYS, J->pc + 2);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        movmi(J, RBASE, slot(a++) + TT, LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      Opnd uv;
+      upvaladdr(J, RDX, GETARG_B(i));
+      uv.b = RDX; uv.d = 0; uv.tt = -1;
+      copytv(J, uv, RBASE, slot(a));
+      break;
+    }
+    case OP_SETUPVAL: {
+      opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+      opm(J, 0, 1, X_MOVRM, RSI, RCLOSURE,
+          cast_int(offsetof(LClosure, upvals) +
+                   GETARG_B(i) * sizeof(UpVal *)));
+      opm(J, 0, 1, X_LEA, RDX, RBASE, slot(a));
+      callhelper(J, jit_setupval);
+      break;
+    }
+    case OP_GETTABUP: {
+      upvaladdr(J, RSI, GETARG_B(i));
+      gettable(J, a, GETARG_C(i));
+      break;
+    }
+    case OP_GETTABLE: {
+      opm(J, 0, 1, X_LEA, RSI, RBASE, slot(GETARG_B(i)));
+      gettable(J, a, GETARG_C(i));
+      break;
+    }
+    case OP_SETTABUP: {
+      upvaladdr(J, RSI, a);
+      settable(J, GETARG_B(i), GETARG_C(i));
+      break;
+    }
+    case OP_SETTABLE: {
+      opm(J, 0, 1, X_LEA, RSI, RBASE, slot(a));
+      settable(J, GETARG_B(i), GETARG_C(i));
+      break;
+    }
+    case OP_SELF: {
+      if (!isKstr(J, GETARG_C(i))) {
+        jfail(J, CC_ALWAYS, NULL);
+        break;
+      }
+      copytv(J, reg(GETARG_B(i)), RBASE, slot(a + 1));
+      opm(J, 0, 1, X_LEA, RSI, RBASE, slot(a + 1));
+      gettable(J, a, GETARG_C(i));
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+      arith(J, op, i);
+      break;
+    }
+    case OP_BAND: case OP_BOR: case OP_BXOR: {
+      bitwise(J, op, i);
+      break;
+    }
+    case OP_UNM: {
+      unm(J, i);
+      break;
+    }
+    case OP_NOT: {
+      opnot(J, i);
+      break;
+    }
+    case OP_LEN: {
+      opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+      opm(J, 0, 1, X_LEA, RSI, RBASE, slot(GETARG_B(i)));
+      opm(J, 0, 1, X_LEA, RDX, RBASE, slot(a));
+      callhelpercheck(J, jit_len);
+      break;
+    }
+    case OP_JMP: {
+      jump(J, i);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      compare(J, op, i);
+      break;
+    }
+    case OP_TEST: {
+      test(J, i);
+      break;
+    }
+    case OP_TESTSET: {
+      testset(J, i);
+      break;
+    }
+    case OP_FORLOOP: {
+      forloop(J, i);
+      break;
+    }
+    case OP_FORPREP: {
+      forprep(J, i);
+      break;
+    }
+    case OP_TFORLOOP: {
+      tforloop(J, i);
+      break;
+    }
+    case OP_HOIST: {  /* 'luaV_hoist' returns whether to skip lookups */
+      opr(J, 0, 1, X_MOVMR, RSTATE, RDI);
+      opr(J, 0, 1, X_MOVMR, RCLOSURE, RSI);
+      opr(J, 0, 1, X_MOVMR, RBASE, RDX);
+      movri(J, RCX, cast(size_t, J->p->code + J->pc));
+      callhelper(J, luaV_hoist);
+      eb(J, 0x85); eb(J, 0xC0);  /* test eax, eax */
+      jumppc(J, CC_NE, J->pc + 1 + GETARG_C(i));
+      break;
+    }
+    default: {  /* everything else runs in the interpreter */
+      jfail(J, CC_ALWAYS, NULL);
+      break;
+    }
+  }
+}
+
+
+/*
+** Entry trampoline, called as 'enter(L, ci, target)': saves the
+** callee-saved registers, loads the fixed registers, and jumps to
+** 'target'. The common exit sequence stores in 'savedpc' the pc left
+** in rax by an exit stub and returns.
+*/
+static void prologue (JitState *J) {
+  push(J, RBP); push(J, RBX); push(J, R12);
+  push(J, R13); push(J, R14); push(J, R15);
+  opr(J, 0, 1, 0x83, 5, RSP); eb(J, 8);  /* sub rsp, 8 (align stack) */
+  opr(J, 0, 1, X_MOVMR, RDI, RSTATE);
+  opr(J, 0, 1, X_MOVMR, RSI, RCI);
+  opm(J, 0, 1, X_MOVRM, RBASE, RCI, cast_int(offsetof(CallInfo, u.l.base)));
+  opm(J, 0, 1, X_MOVRM, RCLOSURE, RCI, cast_int(offsetof(CallInfo, func)));
+  opm(J, 0, 1, X_MOVRM, RCLOSURE, RCLOSURE, 0);  /* closure object */
+  movri(J, RKST, cast(size_t, J->p->k));
+  eb(J, 0xFF); eb(J, 0xE2);  /* jmp rdx */
+  J->exitcode = J->pos;
+  opm(J, 0, 1, X_MOVMR, RAX, RCI, cast_int(offsetof(CallInfo, u.l.savedpc)));
+  opr(J, 0, 1, 0x83, 0, RSP); eb(J, 8);  /* add rsp, 8 */
+  pop(J, R15); pop(J, R14); pop(J, R13);
+  pop(J, R12); pop(J, RBX); pop(J, RBP);
+  eb(J, 0xC3);  /* ret */
+}
+
+
+static void exitstubs (JitState *J) {
+  int pc;
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    size_t start = J->pos;
+    lua_assert(start == exitpos(J, pc));
+    movri(J, RAX, cast(size_t, J->p->code + pc));
+    jmpto(J, CC_ALWAYS, J->exitcode);
+    while (J->pos - start < STUBSIZE)
+      eb(J, 0xCC);  /* int3 */
+  }
+}
+
+
+/* emit the whole block; returns its size */
+static size_t emit (JitState *J, size_t header) {
+  int pc;
+  J->pos = header;
+  prologue(J);
+  J->stubs = J->pos;
+  exitstubs(J);
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    J->pc = pc;
+    J->entry[pc] = cast(unsigned int, J->pos);
+    instruction(J, J->p->code[pc]);
+  }
+  return J->pos;
+}
+
+/*
+** Whether instruction 'i' usually runs in native code
+*/
+static int isnative (Proto *p, Instruction i) {
+  switch (GET_BASEOPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_LOADBOOL: case OP_LOADNIL:
+    case OP_GETUPVAL: case OP_SETUPVAL: case OP_GETTABUP: case OP_GETTABLE:
+    case OP_SETTABUP: case OP_SETTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_DIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_UNM: case OP_NOT: case OP_LEN: case OP_LT: case OP_LE:
+    case OP_TEST: case OP_TESTSET: case OP_HOIST:
+      return 1;
+    case OP_EQ:
+      return !(ISK(GETARG_B(i)) && ISK(GETARG_C(i)));
+    case OP_SELF:
+      return ISK(GETARG_C(i)) && ttisshrstring(&p->k[INDEXK(GETARG_C(i))]);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Compute, for each instruction, how many instructions (up to 255) a
+** run of native code starting there is expected to execute before
+** going back to the interpreter, following jumps and taking loops as
+** long runs.
+*/
+static void runlengths (Proto *p, lu_byte *run) {
+  int pc;
+  for (pc = p->sizecode - 1; pc >= 0; pc--) {
+    Instruction i = p->code[pc];
+    int n;
+    switch (GET_BASEOPCODE(i)) {
+      case OP_FORLOOP: case OP_TFORLOOP: {
+        n = 255;
+        break;
+      }
+      case OP_JMP: case OP_FORPREP: {
+        int target = pc + 1 + GETARG_sBx(i);
+        n = (target <= pc) ? 255 : 1 + run[target];
+        break;
+      }
+      default: {
+        if (!isnative(p, i)) n = 0;
+        else n = 1 + ((pc + 1 < p->sizecode) ? run[pc + 1] : 0);
+        break;
+      }
+    }
+    run[pc] = cast_byte((n > 255) ? 255 : n);
+  }
+}
+
+/* }====================================================== */
+
+
+void luaJ_compile (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  JitState J;
+  JitCode *jc;
+  size_t header, size;
+  unsigned int *entry;
+  void *block;
+  if (!g->jitrunning) {  /* try again later */
+    p->jitcount = g->jithot;
+    return;
+  }
+  p->jitcount = MAX_INT;  /* do not try again */
+  header = offsetof(JitCode, entry) +
+           p->sizecode * (sizeof(unsigned int) + sizeof(lu_byte));
+  header = (header + 15) & ~cast(size_t, 15);
+  entry = luaM_newvector(L, p->sizecode, unsigned int);
+  J.p = p;
+  J.mc = NULL;
+  J.entry = entry;
+  size = emit(&J, header);  /* first pass: compute offsets */
+  block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block != MAP_FAILED) {
+    jc = cast(JitCode *, block);
+    jc->size = size;
+    memcpy(jc->entry, entry, p->sizecode * sizeof(unsigned int));
+    jc->run = cast(lu_byte *, jc->entry + p->sizecode);
+    runlengths(p, jc->run);
+    J.mc = cast(lu_byte *, block);
+    J.entry = jc->entry;
+    emit(&J, header);  /* second pass: generate code */
+    jc->enter = cast(lua_JitEnter, J.mc + header);
+    if (mprotect(block, size, PROT_READ | PROT_EXEC) == 0)
+      p->jit = jc;
+    else
+      munmap(block, size);
+  }
+  luaM_freearray(L, entry, p->sizecode);
+}
+
+
+void luaJ_execute (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  JitCode *jc = p->jit;
+  const lu_byte *mc = cast(const lu_byte *, jc);
+  jc->enter(L, ci, mc + jc->entry[ci->u.l.savedpc - p->code]);
+}
+
+
+void luaJ_freecode (lua_State *L, Proto *p) {
+  UNUSED(L);
+  munmap(p->jit, p->jit->size);
+  p->jit = NULL;
+}
+
+
+#else  /* no native compiler */
+
+
+void luaJ_compile (lua_State *L, Proto *p) {
+  p->jitcount = MAX_INT;
+  UNUSED(L);
+}
+
+
+void luaJ_execute (lua_State *L, CallInfo *ci) {
+  UNUSED(L); UNUSED(ci);
+}
+
+
+void luaJ_freecode (lua_State *L, Proto *p) {
+  UNUSED(L);
+  p->jit = NULL;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to native code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The native compiler is optional: it is built only when LUA_USE_JIT
+** is defined, and only for x86-64 Linux. Otherwise, all functions run
+** in the interpreter.
+*/
+#if defined(LUA_USE_JIT) && defined(__x86_64__) && defined(__linux__)
+#define LUAJ_NATIVE	1
+#else
+#define LUAJ_NATIVE	0
+#endif
+
+
+/*
+** Default number of calls plus backward jumps after which a function
+** is compiled.
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	1000
+#endif
+
+/*
+** Minimum expected number of instructions executed in native code
+** for it to be worth entering it from the interpreter. (Entering and
+** leaving native code costs about as much as interpreting a few
+** instructions.)
+*/
+#if !defined(LUAI_JITMINRUN)
+#define LUAI_JITMINRUN	6
+#endif
+
+
+typedef void (*lua_JitEnter) (lua_State *L, CallInfo *ci, const void *target);
+
+
+/* native code of a prototype */
+typedef struct JitCode {
+  size_t size;  /* size of the whole block */
+  lua_JitEnter enter;  /* entry trampoline */
+  lu_byte *run;  /* expected length of native runs from each instruction */
+  unsigned int entry[1];  /* offset of the code of each instruction */
+} JitCode;
+
+
+/* whether execution should move to native code at the current pc */
+#define luaJ_worth(L,ci,p)  \
+	((p)->jit->run[(ci)->u.l.savedpc - (p)->code] >= LUAI_JITMINRUN && \
+	 G(L)->jitrunning && !((L)->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)))
+
+
+LUAI_FUNC void luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_execute (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_freecode (lua_State *L, Proto *p);
+
+#endif
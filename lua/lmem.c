@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lgc.h"
 #include "lmem.h"
+#include "lmemprof.h"
 #include "lobject.h"
 #include "lstate.h"
 
@@ -70,6 +71,71 @@ l_noret luaM_toobig (lua_State *L) {
 }
 
 
+/*
+** Set limit 'what' (LUA_MEMSOFT or LUA_MEMHARD; 0 is no limit) and
+** return its previous value. 'memcheck' keeps the lowest limit, so
+** that allocations below all limits need a single test.
+*/
+size_t luaM_setlimit (lua_State *L, int what, size_t limit) {
+  global_State *g = G(L);
+  size_t old = g->memlimit[what];
+  lu_mem soft, hard;
+  g->memlimit[what] = limit;
+  soft = g->memlimit[LUA_MEMSOFT];
+  hard = g->memlimit[LUA_MEMHARD];
+  if (soft == 0 || (hard != 0 && hard < soft))
+    soft = hard;  /* lowest limit */
+  g->memcheck = (soft == 0 || soft > cast(lu_mem, MAX_LMEM)) ? MAX_LMEM
+                                                             : cast(l_mem, soft);
+  return old;
+}
+
+
+/*
+** Ask the host about a crossed limit
+*/
+static lu_mem crossed (lua_State *L, int what, lu_mem total) {
+  global_State *g = G(L);
+  if (g->memlimitf != NULL) {
+    size_t limit = (*g->memlimitf)(g->memlimitud, L, what, total,
+                                   g->memlimit[what]);
+    luaM_setlimit(L, what, limit);
+  }
+  return g->memlimit[what];
+}
+
+
+/*
+** Called when allocating 'delta' more bytes takes the memory in use
+** above the lowest limit. Above the hard limit, run an emergency
+** collection and then ask the host; if the memory still does not fit,
+** raise a memory error. Above the soft limit, make the collector run a
+** step at its next check (unless one is pending already), asking the
+** host each time.
+*/
+static void checklimits (lua_State *L, size_t delta) {
+  global_State *g = G(L);
+  lu_mem total = gettotalbytes(g) + delta;
+  lu_mem limit = g->memlimit[LUA_MEMHARD];
+  if (!g->version)  /* state not fully built? */
+    return;
+  if (limit != 0 && total > limit) {
+    luaC_fullgc(L, 1);  /* try to free some memory... */
+    total = gettotalbytes(g) + delta;
+    if (total > limit) {
+      limit = crossed(L, LUA_MEMHARD, total);
+      if (limit != 0 && total > limit)
+        luaD_throw(L, LUA_ERRMEM);
+    }
+  }
+  limit = g->memlimit[LUA_MEMSOFT];
+  if (limit != 0 && total > limit && g->GCdebt <= 0) {
+    crossed(L, LUA_MEMSOFT, total);
+    luaE_setdebt(g, 0);  /* this allocation makes the collector run */
+  }
+}
+
+
 
 /*
 ** generic allocation routine.
@@ -78,11 +144,18 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   void *newblock;
   global_State *g = G(L);
   size_t realosize = (block) ? osize : 0;
+  int site = -1;  /* profiler site of the new block (if sampled) */
   lua_assert((realosize == 0) == (block == NULL));
 #if defined(HARDMEMTESTS)
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
+  if (nsize > realosize &&  /* above a memory limit? */
+      cast(lu_mem, gettotalbytes(g)) + (nsize - realosize) >
+      cast(lu_mem, g->memcheck))
+    checklimits(L, nsize - realosize);
+  if (g->memprof)  /* heap profiler on? (look at the stack before it moves) */
+    site = luaM_profsample(L, nsize);
   newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
@@ -94,6 +167,8 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
       luaD_throw(L, LUA_ERRMEM);
   }
   lua_assert((nsize == 0) == (newblock == NULL));
+  if (g->memprof)
+    luaM_proftrack(g, block, newblock, nsize, site);
   g->GCdebt = (g->GCdebt + nsize) - realosize;
   return newblock;
 }
@@ -57,6 +57,7 @@
    ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t))))
 
 LUAI_FUNC l_noret luaM_toobig (lua_State *L);
+LUAI_FUNC size_t luaM_setlimit (lua_State *L, int what, size_t limit);
 
 /* not to be called directly */
 LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
@@ -0,0 +1,399 @@
+/*
+** $Id: lmemprof.c $
+** Sampling heap profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lmemprof_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lmem.h"
+#include "lmemprof.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+
+
+/*
+** A sample is taken after about 'rate' bytes were allocated (the
+** interval is random, so that regular allocation patterns do not bias
+** the samples), and it stands for 'rate' bytes, or for its own size if
+** larger. Each sample is charged to its site: the Lua call stack at the
+** allocation, kept as a "folded" line (frames from the outermost one,
+** separated by ';'). Sampled blocks stay in a table until they are
+** freed, so that each site knows how many of its bytes are still in
+** use. The profiler gets its memory from the raw allocation function,
+** because it works inside 'luaM_realloc_', where it must not raise
+** errors, and its memory is not Lua memory.
+*/
+
+
+/* space for a frame: source, ':', line and ';' */
+#define FRAMESIZE	(LUA_IDSIZE + 16)
+
+/* space for the stack of a site */
+#define STACKSIZE	(LUAI_PROFDEPTH * FRAMESIZE + 8)
+
+/* initial sizes of the tables of sites and of sampled blocks */
+#define MINSITES	64
+#define MINBLOCKS	256
+
+
+#define rawrealloc(g,b,os,ns)	((*(g)->frealloc)((g)->ud, (b), (os), (ns)))
+
+
+typedef struct ProfSite {
+  char *stack;  /* folded stack */
+  size_t len;  /* length of 'stack' */
+  unsigned int hash;
+  int next;  /* next site in the same bucket (-1 ends the chain) */
+  lu_mem bytes[3];  /* live, allocated and freed bytes (LUA_PROF*) */
+} ProfSite;
+
+
+typedef struct ProfBlock {
+  void *block;  /* NULL in empty entries */
+  lu_mem size;  /* bytes it stands for */
+  int site;
+} ProfBlock;
+
+
+typedef struct MemProf {
+  l_mem left;  /* bytes to be allocated before the next sample */
+  int rate;  /* mean number of bytes between samples */
+  unsigned int rand;  /* state of the generator of intervals */
+  ProfSite *sites;
+  int *buckets;  /* first site in each chain ('sizesites' of them) */
+  int nsites;
+  int sizesites;  /* 0 or a power of 2 */
+  ProfBlock *blocks;  /* sampled blocks in use (open addressing) */
+  int nblocks;
+  int sizeblocks;  /* 0 or a power of 2 */
+} MemProf;
+
+
+static l_mem nextinterval (MemProf *mp) {
+  unsigned int r = mp->rand = mp->rand * 1103515245u + 12345u;
+  return mp->rate / 2 + cast(l_mem, (r >> 8) % cast(unsigned int, mp->rate))
+                      + 1;
+}
+
+
+/*
+** {======================================================
+** Sites
+** =======================================================
+*/
+
+/*
+** Write in 'buff' the folded stack of thread 'L'. The line of a
+** function that has not started yet is the line where it is defined.
+*/
+static size_t getstack (lua_State *L, char *buff) {
+  CallInfo *frames[LUAI_PROFDEPTH];
+  CallInfo *ci;
+  size_t len = 0;
+  int n = 0;
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous) {
+    if (n == LUAI_PROFDEPTH) {  /* too deep? */
+      memcpy(buff, "...;", 4);
+      len = 4;
+      break;
+    }
+    frames[n++] = ci;
+  }
+  if (n == 0) {  /* allocation made directly by the host? */
+    memcpy(buff, "[C]", 3);
+    return 3;
+  }
+  while (n-- > 0) {
+    ci = frames[n];
+    if (isLua(ci)) {
+      Proto *p = clLvalue(ci->func)->p;
+      int line = (ci->u.l.savedpc > p->code) ? luaG_currentline(ci)
+                                             : p->linedefined;
+      luaO_chunkid(buff + len, p->source ? getstr(p->source) : "=?",
+                   LUA_IDSIZE);
+      len += strlen(buff + len);
+      len += l_sprintf(buff + len, FRAMESIZE - LUA_IDSIZE, ":%d;", line);
+    }
+    else {
+      memcpy(buff + len, "[C];", 4);
+      len += 4;
+    }
+  }
+  return len - 1;  /* remove last ';' */
+}
+
+
+static int growsites (global_State *g, MemProf *mp) {
+  int size = (mp->sizesites > 0) ? 2 * mp->sizesites : MINSITES;
+  int *buckets = cast(int *, rawrealloc(g, NULL, 0, size * sizeof(int)));
+  ProfSite *sites;
+  int i;
+  if (buckets == NULL)
+    return 0;
+  sites = cast(ProfSite *, rawrealloc(g, mp->sites,
+                 mp->sizesites * sizeof(ProfSite), size * sizeof(ProfSite)));
+  if (sites == NULL) {
+    rawrealloc(g, buckets, size * sizeof(int), 0);
+    return 0;
+  }
+  rawrealloc(g, mp->buckets, mp->sizesites * sizeof(int), 0);
+  for (i = 0; i < size; i++)
+    buckets[i] = -1;
+  for (i = 0; i < mp->nsites; i++) {  /* rebuild chains */
+    int b = lmod(sites[i].hash, size);
+    sites[i].next = buckets[b];
+    buckets[b] = i;
+  }
+  mp->sites = sites;
+  mp->buckets = buckets;
+  mp->sizesites = size;
+  return 1;
+}
+
+
+/*
+** Index of the site with the given stack (creating it if needed), or
+** -1 if there is no memory for a new site.
+*/
+static int findsite (global_State *g, MemProf *mp, const char *stack,
+                     size_t len) {
+  unsigned int h = luaS_hash(stack, len, g->seed);
+  ProfSite *s;
+  int b, i;
+  if (mp->sizesites > 0) {
+    for (i = mp->buckets[lmod(h, mp->sizesites)]; i >= 0; i = s->next) {
+      s = &mp->sites[i];
+      if (s->hash == h && s->len == len && memcmp(s->stack, stack, len) == 0)
+        return i;
+    }
+  }
+  if (mp->nsites == mp->sizesites && !growsites(g, mp))
+    return -1;
+  s = &mp->sites[mp->nsites];
+  if ((s->stack = cast(char *, rawrealloc(g, NULL, 0, len))) == NULL)
+    return -1;
+  memcpy(s->stack, stack, len);
+  s->len = len;
+  s->hash = h;
+  s->bytes[LUA_PROFLIVE] = s->bytes[LUA_PROFALLOC] = 0;
+  s->bytes[LUA_PROFFREED] = 0;
+  b = lmod(h, mp->sizesites);
+  s->next = mp->buckets[b];
+  mp->buckets[b] = mp->nsites;
+  return mp->nsites++;
+}
+
+
+/*
+** Take a sample: find the site of the current allocation. (Its buffer
+** stays out of the frame of 'luaM_profsample'.)
+*/
+static int newsample (lua_State *L, MemProf *mp) {
+  char stack[STACKSIZE];
+  size_t len = getstack(L, stack);
+  return findsite(G(L), mp, stack, len);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Sampled blocks
+** =======================================================
+*/
+
+static int blockslot (MemProf *mp, void *b) {
+  unsigned int h = point2uint(b);
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return lmod(h, mp->sizeblocks);
+}
+
+
+#define nextslot(mp,i)	lmod((i) + 1, (mp)->sizeblocks)
+
+
+static int growblocks (global_State *g, MemProf *mp) {
+  int osize = mp->sizeblocks;
+  ProfBlock *old = mp->blocks;
+  int size = (osize > 0) ? 2 * osize : MINBLOCKS;
+  ProfBlock *v = cast(ProfBlock *,
+                      rawrealloc(g, NULL, 0, size * sizeof(ProfBlock)));
+  int i;
+  if (v == NULL)
+    return 0;
+  for (i = 0; i < size; i++)
+    v[i].block = NULL;
+  mp->blocks = v;
+  mp->sizeblocks = size;
+  for (i = 0; i < osize; i++) {  /* reinsert old entries */
+    if (old[i].block != NULL) {
+      int j = blockslot(mp, old[i].block);
+      while (v[j].block != NULL)
+        j = nextslot(mp, j);
+      v[j] = old[i];
+    }
+  }
+  rawrealloc(g, old, osize * sizeof(ProfBlock), 0);
+  return 1;
+}
+
+
+static void track (global_State *g, MemProf *mp, void *b, lu_mem size,
+                   int site) {
+  int i;
+  if (2 * (mp->nblocks + 1) > mp->sizeblocks && !growblocks(g, mp))
+    return;  /* no memory to keep the sample */
+  for (i = blockslot(mp, b); mp->blocks[i].block != NULL; i = nextslot(mp, i))
+    ;
+  mp->blocks[i].block = b;
+  mp->blocks[i].size = size;
+  mp->blocks[i].site = site;
+  mp->nblocks++;
+  mp->sites[site].bytes[LUA_PROFALLOC] += size;
+  mp->sites[site].bytes[LUA_PROFLIVE] += size;
+}
+
+
+/*
+** If 'b' was sampled, charge its release to its site and remove it
+** from the table (moving back entries after it, so that no lookup
+** meets an empty entry before its key).
+*/
+static void untrack (MemProf *mp, void *b) {
+  ProfSite *s;
+  int i, j;
+  for (i = blockslot(mp, b); mp->blocks[i].block != b; i = nextslot(mp, i)) {
+    if (mp->blocks[i].block == NULL)
+      return;  /* not sampled */
+  }
+  s = &mp->sites[mp->blocks[i].site];
+  s->bytes[LUA_PROFLIVE] -= mp->blocks[i].size;
+  s->bytes[LUA_PROFFREED] += mp->blocks[i].size;
+  mp->nblocks--;
+  for (j = nextslot(mp, i); mp->blocks[j].block != NULL; j = nextslot(mp, j)) {
+    int k = blockslot(mp, mp->blocks[j].block);  /* where 'j' should be */
+    if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+      continue;  /* 'j' cannot move to 'i' */
+    mp->blocks[i] = mp->blocks[j];
+    i = j;
+  }
+  mp->blocks[i].block = NULL;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** Called by 'luaM_realloc_' before it allocates 'nsize' bytes: return
+** the site of the new block if it is to be sampled, or -1.
+*/
+int luaM_profsample (lua_State *L, size_t nsize) {
+  MemProf *mp = G(L)->memprof;
+  mp->left -= cast(l_mem, nsize);
+  if (mp->left > 0)  /* usual case */
+    return -1;
+  mp->left = nextinterval(mp);
+  return newsample(L, mp);
+}
+
+
+/*
+** Called by 'luaM_realloc_' after it replaced 'block' by 'newblock'
+** (either may be NULL).
+*/
+void luaM_proftrack (global_State *g, void *block, void *newblock,
+                     size_t nsize, int site) {
+  MemProf *mp = g->memprof;
+  if (block != NULL && mp->nblocks > 0)
+    untrack(mp, block);
+  if (site >= 0 && newblock != NULL) {
+    lu_mem size = (nsize > cast(size_t, mp->rate)) ? nsize
+                                                    : cast(size_t, mp->rate);
+    track(g, mp, newblock, size, site);
+  }
+}
+
+
+/*
+** Start the profiler (or change its rate) if 'rate' > 0; stop it and
+** discard its data if 'rate' == 0. Return the previous rate (0 if the
+** profiler was off).
+*/
+int luaM_setprofile (lua_State *L, int rate) {
+  global_State *g = G(L);
+  MemProf *mp = g->memprof;
+  int old = (mp != NULL) ? mp->rate : 0;
+  if (rate > 0) {
+    if (mp == NULL) {
+      mp = luaM_new(L, MemProf);
+      mp->rand = g->seed;
+      mp->sites = NULL;
+      mp->buckets = NULL;
+      mp->nsites = mp->sizesites = 0;
+      mp->blocks = NULL;
+      mp->nblocks = mp->sizeblocks = 0;
+      g->memprof = mp;
+    }
+    mp->rate = rate;
+    mp->left = nextinterval(mp);
+  }
+  else if (rate == 0 && mp != NULL) {
+    int i;
+    g->memprof = NULL;
+    for (i = 0; i < mp->nsites; i++)
+      rawrealloc(g, mp->sites[i].stack, mp->sites[i].len, 0);
+    rawrealloc(g, mp->sites, mp->sizesites * sizeof(ProfSite), 0);
+    rawrealloc(g, mp->buckets, mp->sizesites * sizeof(int), 0);
+    rawrealloc(g, mp->blocks, mp->sizeblocks * sizeof(ProfBlock), 0);
+    luaM_free(L, mp);
+  }
+  return old;
+}
+
+
+/*
+** Write one line for each site with some bytes of kind 'what': its
+** folded stack and the number of bytes. Return the first non-zero
+** status from 'writer', 0 after all lines, or -1 if the profiler is off.
+** (The writer may allocate memory, so sites can be added meanwhile;
+** each line is copied out before being written.)
+*/
+int luaM_profdump (lua_State *L, int what, lua_Writer writer, void *data) {
+  char line[STACKSIZE + 48];  /* stack, ' ', number and '\n' */
+  int status = 0;
+  int i;
+  if (G(L)->memprof == NULL)
+    return -1;
+  for (i = 0; status == 0; i++) {
+    MemProf *mp = G(L)->memprof;
+    ProfSite *s;
+    size_t len;
+    if (mp == NULL || i >= mp->nsites)
+      break;
+    s = &mp->sites[i];
+    if (s->bytes[what] == 0)
+      continue;
+    memcpy(line, s->stack, s->len);
+    len = s->len;
+    len += l_sprintf(line + len, 48, " " LUA_INTEGER_FMT "\n",
+                     cast(LUAI_UACINT, s->bytes[what]));
+    status = (*writer)(L, line, len, data);
+  }
+  return status;
+}
@@ -0,0 +1,27 @@
+/*
+** $Id: lmemprof.h $
+** Sampling heap profiler
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lmemprof_h
+#define lmemprof_h
+
+
+#include "lstate.h"
+
+
+/* maximum number of frames kept for each sampled allocation */
+#if !defined(LUAI_PROFDEPTH)
+#define LUAI_PROFDEPTH	20
+#endif
+
+
+LUAI_FUNC int luaM_setprofile (lua_State *L, int rate);
+LUAI_FUNC int luaM_profsample (lua_State *L, size_t nsize);
+LUAI_FUNC void luaM_proftrack (global_State *g, void *block, void *newblock,
+                                                size_t nsize, int site);
+LUAI_FUNC int luaM_profdump (lua_State *L, int what, lua_Writer writer,
+                                                     void *data);
+
+#endif
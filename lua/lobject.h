@@ -423,6 +423,9 @@ typedef struct Proto {
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
+  unsigned int *icache;  /* inline caches (one per instruction) */
+  struct JitCode *jit;  /* native code (NULL if not compiled) */
+  int jitcount;  /* countdown to compiling this function */
   struct LClosure *cache;  /* last-created closure with this prototype */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
@@ -498,10 +501,17 @@ typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
+  lu_byte atype;  /* type of all values in a packed 'array' (see ltable.h) */
+  lu_byte lsmall;  /* room for nodes in the table block (see ltable.c) */
   unsigned int sizearray;  /* size of 'array' array */
+  unsigned int lastnext;  /* position of the last key given by 'luaH_next' */
   TValue *array;  /* array part */
   Node *node;
   Node *lastfree;  /* any free position is before this position */
+  struct OldNodes *old;  /* hash part being replaced (see ltable.h) */
+  struct Cards *cards;  /* dirty parts, for the collector (see lgc.c) */
+  unsigned int hfree;  /* number of free positions in 'node' */
+  unsigned int lenhint;  /* last border found by 'luaH_getn' */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
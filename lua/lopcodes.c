@@ -65,6 +65,23 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "HOIST",
+  "ADDINT",
+  "ADDFLT",
+  "SUBINT",
+  "SUBFLT",
+  "MULINT",
+  "MULFLT",
+  "LTINT",
+  "LTFLT",
+  "LEINT",
+  "LEFLT",
+  "MOVECALL",
+  "GETTABUPTAB",
+  "GETTABADD",
+  "MULADD",
+  "ADDFORLOOP",
+  "SETTABFORLOOP",
   NULL
 };
 
@@ -120,5 +137,45 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, OpArgR, OpArgU, iABC)		/* OP_HOIST */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDINT */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDFLT */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBINT */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBFLT */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULINT */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULFLT */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTINT */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTFLT */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LEINT */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LEFLT */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUPTAB */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABADD */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULADD */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDFORLOOP */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETTABFORLOOP */
+};
+
+
+LUAI_DDEF const lu_byte luaP_baseop[NUM_OPCODES] = {
+  OP_MOVE, OP_LOADK, OP_LOADKX, OP_LOADBOOL, OP_LOADNIL, OP_GETUPVAL,
+  OP_GETTABUP, OP_GETTABLE, OP_SETTABUP, OP_SETUPVAL, OP_SETTABLE,
+  OP_NEWTABLE, OP_SELF, OP_ADD, OP_SUB, OP_MUL, OP_MOD, OP_POW, OP_DIV,
+  OP_IDIV, OP_BAND, OP_BOR, OP_BXOR, OP_SHL, OP_SHR, OP_UNM, OP_BNOT,
+  OP_NOT, OP_LEN, OP_CONCAT, OP_JMP, OP_EQ, OP_LT, OP_LE, OP_TEST,
+  OP_TESTSET, OP_CALL, OP_TAILCALL, OP_RETURN, OP_FORLOOP, OP_FORPREP,
+  OP_TFORCALL, OP_TFORLOOP, OP_SETLIST, OP_CLOSURE, OP_VARARG,
+  OP_EXTRAARG, OP_HOIST,
+  OP_ADD, OP_ADD,  /* OP_ADDINT, OP_ADDFLT */
+  OP_SUB, OP_SUB,  /* OP_SUBINT, OP_SUBFLT */
+  OP_MUL, OP_MUL,  /* OP_MULINT, OP_MULFLT */
+  OP_LT, OP_LT,  /* OP_LTINT, OP_LTFLT */
+  OP_LE, OP_LE,  /* OP_LEINT, OP_LEFLT */
+  OP_MOVE,  /* OP_MOVECALL */
+  OP_GETTABUP,  /* OP_GETTABUPTAB */
+  OP_GETTABLE,  /* OP_GETTABADD */
+  OP_MUL,  /* OP_MULADD */
+  OP_ADD,  /* OP_ADDFORLOOP */
+  OP_SETTABLE  /* OP_SETTABFORLOOP */
 };
 
@@ -230,11 +230,36 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_HOIST,/*	B C	if R(B+1) is current then R(X) := R(B); pc+=C	*/
+
+/* quickened forms (see note below) */
+OP_ADDINT,/*	A B C	R(A) := RK(B) + RK(C) (both integers)		*/
+OP_ADDFLT,/*	A B C	R(A) := RK(B) + RK(C) (both floats)		*/
+OP_SUBINT,/*	A B C	R(A) := RK(B) - RK(C) (both integers)		*/
+OP_SUBFLT,/*	A B C	R(A) := RK(B) - RK(C) (both floats)		*/
+OP_MULINT,/*	A B C	R(A) := RK(B) * RK(C) (both integers)		*/
+OP_MULFLT,/*	A B C	R(A) := RK(B) * RK(C) (both floats)		*/
+OP_LTINT,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++ (integers)	*/
+OP_LTFLT,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++ (floats)	*/
+OP_LEINT,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++ (integers)	*/
+OP_LEFLT,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++ (floats)	*/
+
+/* superinstructions (see note below) */
+OP_MOVECALL,/*	MOVE followed by CALL				*/
+OP_GETTABUPTAB,/* GETTABUP followed by GETTABLE			*/
+OP_GETTABADD,/*	GETTABLE followed by ADD			*/
+OP_MULADD,/*	MUL followed by ADD				*/
+OP_ADDFORLOOP,/* ADD followed by FORLOOP			*/
+OP_SETTABFORLOOP/* SETTABLE followed by FORLOOP			*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_SETTABFORLOOP) + 1)
+
+/* number of opcodes that can appear in code generated by the compiler */
+#define NUM_BASEOPCODES	(cast(int, OP_HOIST) + 1)
 
 
 
@@ -259,6 +284,35 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) OP_HOIST keeps in R(B) the result of the C lookups that follow
+  it (a GETTABUP with a constant key, possibly followed by a GETTABLE
+  of its result with a constant key), and in R(B+1) the hoisting epoch
+  when that value was looked up. While R(B+1) is the current epoch, it
+  copies R(B) into the register X set by the last of those lookups and
+  skips them; otherwise, it redoes them without metamethods (or leaves
+  them to run) and records the result. Writes to fields with the keys
+  of such lookups, changes of metatables, and changes of upvalues
+  holding tables start a new epoch (see 'luaV_hoist').
+
+  (*) Opcodes after OP_HOIST are never saved in precompiled chunks
+  ('DumpCode' writes every instruction in its regular form), and the
+  code generator proper never emits them; 'luaP_baseop' maps every
+  opcode to the regular opcode it stands for. They appear in two ways:
+
+  - Quickened forms are made at run time: the interpreter rewrites
+  ("quickens") an instruction into one of them after seeing its
+  operands with a stable type, and rewrites it back when that guess
+  fails.
+
+  - Superinstructions are made when a function is ready to run: after
+  parsing (see 'finishcode' in lparser.c) and after loading a
+  precompiled chunk (see lundump.c), 'luaK_fuse' replaces the first
+  instruction of a frequent pair by one. A superinstruction executes
+  that instruction and then the following one, without an intervening
+  dispatch. The second instruction is left untouched, so jumps to it
+  still work. Its regular opcode (in 'luaP_baseop') is the one of the
+  first instruction.
+
 ===========================================================================*/
 
 
@@ -289,6 +343,11 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+LUAI_DDEC const lu_byte luaP_baseop[NUM_OPCODES];
+
+/* regular opcode of an instruction (undoing any quickening) */
+#define GET_BASEOPCODE(i)	(cast(OpCode, luaP_baseop[GET_OPCODE(i)]))
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
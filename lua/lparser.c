@@ -542,6 +542,7 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->nactvar = 0;
   fs->firstlocal = ls->dyd->actvar.n;
   fs->bl = NULL;
+  fs->hs = NULL;
   f = fs->f;
   f->source = ls->source;
   f->maxstacksize = 2;  /* registers 0/1 are always valid */
@@ -1238,13 +1239,53 @@ static void labelstat (LexState *ls, TString *label, int line) {
 }
 
 
+/*
+** When hoisting is on (see 'lua_compileropts'), give an outermost loop
+** (in the scope 'bl' around it) hidden registers for the lookups done
+** inside it, all starting with an invalid epoch. Lookups are hoisted
+** only when 'active' (which 'forbody' sets after the header of a 'for'
+** loop, evaluated once). Return whether the loop got the registers.
+*/
+static int enterhoist (LexState *ls, HoistSet *hs, BlockCnt *bl,
+                       int active) {
+  FuncState *fs = ls->fs;
+  int i;
+  enterblock(fs, bl, 0);
+  if (!(G(ls->L)->copts & LUA_COPTHOIST) || fs->hs != NULL ||
+      fs->nactvar + 2 * MAXHOIST > MAXVARS / 2)
+    return 0;
+  for (i = 0; i < 2 * MAXHOIST; i++)
+    new_localvarliteral(ls, "(hoist)");
+  adjustlocalvars(ls, 2 * MAXHOIST);
+  hs->base = fs->freereg;
+  hs->n = 0;
+  luaK_reserveregs(fs, 2 * MAXHOIST);
+  luaK_nil(fs, hs->base, 2 * MAXHOIST);
+  hs->startpc = fs->pc;
+  hs->active = cast_byte(active);
+  fs->hs = hs;
+  return 1;
+}
+
+
+static void leavehoist (LexState *ls, int hoisting) {
+  FuncState *fs = ls->fs;
+  if (hoisting)
+    luaK_closehoist(fs);
+  leaveblock(fs);
+}
+
+
 static void whilestat (LexState *ls, int line) {
   /* whilestat -> WHILE cond DO block END */
   FuncState *fs = ls->fs;
   int whileinit;
   int condexit;
-  BlockCnt bl;
+  BlockCnt bl, hbl;
+  HoistSet hs;
+  int hoisting;
   luaX_next(ls);  /* skip WHILE */
+  hoisting = enterhoist(ls, &hs, &hbl, 1);
   whileinit = luaK_getlabel(fs);
   condexit = cond(ls);
   enterblock(fs, &bl, 1);
@@ -1254,6 +1295,7 @@ static void whilestat (LexState *ls, int line) {
   check_match(ls, TK_END, TK_WHILE, line);
   leaveblock(fs);
   luaK_patchtohere(fs, condexit);  /* false conditions finish the loop */
+  leavehoist(ls, hoisting);
 }
 
 
@@ -1261,8 +1303,10 @@ static void repeatstat (LexState *ls, int line) {
   /* repeatstat -> REPEAT block UNTIL cond */
   int condexit;
   FuncState *fs = ls->fs;
+  BlockCnt bl1, bl2, hbl;
+  HoistSet hs;
+  int hoisting = enterhoist(ls, &hs, &hbl, 1);
   int repeat_init = luaK_getlabel(fs);
-  BlockCnt bl1, bl2;
   enterblock(fs, &bl1, 1);  /* loop block */
   enterblock(fs, &bl2, 0);  /* scope block */
   luaX_next(ls);  /* skip REPEAT */
@@ -1274,6 +1318,7 @@ static void repeatstat (LexState *ls, int line) {
   leaveblock(fs);  /* finish scope */
   luaK_patchlist(fs, condexit, repeat_init);  /* close the loop */
   leaveblock(fs);  /* finish loop */
+  leavehoist(ls, hoisting);
 }
 
 
@@ -1296,6 +1341,8 @@ static void forbody (LexState *ls, int base, int line, int nvars, int isnum) {
   adjustlocalvars(ls, 3);  /* control variables */
   checknext(ls, TK_DO);
   prep = isnum ? luaK_codeAsBx(fs, OP_FORPREP, base, NO_JUMP) : luaK_jump(fs);
+  if (fs->hs != NULL)
+    fs->hs->active = 1;  /* hoist lookups from the body */
   enterblock(fs, &bl, 0);  /* scope for declared variables */
   adjustlocalvars(ls, nvars);
   luaK_reserveregs(fs, nvars);
@@ -1365,7 +1412,9 @@ static void forstat (LexState *ls, int line) {
   /* forstat -> FOR (fornum | forlist) END */
   FuncState *fs = ls->fs;
   TString *varname;
-  BlockCnt bl;
+  BlockCnt bl, hbl;
+  HoistSet hs;
+  int hoisting = enterhoist(ls, &hs, &hbl, 0);
   enterblock(fs, &bl, 1);  /* scope for loop and control variables */
   luaX_next(ls);  /* skip 'for' */
   varname = str_checkname(ls);  /* first variable name */
@@ -1376,6 +1425,7 @@ static void forstat (LexState *ls, int line) {
   }
   check_match(ls, TK_END, TK_FOR, line);
   leaveblock(fs);  /* loop scope ('break' jumps to this point) */
+  leavehoist(ls, hoisting);
 }
 
 
@@ -1623,6 +1673,20 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 }
 
 
+/*
+** Create the inline caches of 'f' and of all functions nested in it,
+** and fuse their instruction pairs. (Both need the final code, after
+** 'luaK_optimize'.)
+*/
+static void finishcode (lua_State *L, Proto *f) {
+  int i;
+  luaF_newicache(L, f);
+  luaK_fuse(f);
+  for (i = 0; i < f->sizep; i++)
+    finishcode(L, f->p[i]);
+}
+
+
 LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                        Dyndata *dyd, const char *name, int firstchar) {
   LexState lexstate;
@@ -1644,6 +1708,9 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
   lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  if (G(L)->copts & LUA_COPTCONST)
+    luaK_optimize(L, cl->p, buff);
+  finishcode(L, cl->p);
   L->top--;  /* remove scanner's table */
   return cl;  /* closure is on the stack, too */
 }
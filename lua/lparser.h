@@ -107,6 +107,27 @@ typedef struct Dyndata {
 struct BlockCnt;  /* defined in lparser.c */
 
 
+/* maximum number of lookups hoisted out of a loop */
+#define MAXHOIST	8
+
+/*
+** Hidden registers of an outermost loop, which keep the values of
+** lookups done inside it (see OP_HOIST). Pair 'i' is at registers
+** 'base + 2*i' (value) and 'base + 2*i + 1' (epoch).
+*/
+typedef struct HoistSet {
+  int startpc;  /* first instruction of the loop */
+  int base;  /* first hidden register */
+  int n;  /* number of pairs in use */
+  lu_byte active;  /* false in the header of a 'for' loop */
+  struct {
+    int up;  /* upvalue with the table */
+    int key[2];  /* constant keys of the lookups ('key[1]' may be -1) */
+    int nuses;  /* number of OP_HOIST using the pair */
+  } path[MAXHOIST];
+} HoistSet;
+
+
 /* state needed to generate code for a given function */
 typedef struct FuncState {
   Proto *f;  /* current function header */
@@ -123,6 +144,7 @@ typedef struct FuncState {
   lu_byte nactvar;  /* number of active local variables */
   lu_byte nups;  /* number of upvalues */
   lu_byte freereg;  /* first free register */
+  HoistSet *hs;  /* hidden registers of current loop (or NULL) */
 } FuncState;
 
 
@@ -20,12 +20,15 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lmemprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
 
 
 #if !defined(LUAI_GCPAUSE)
@@ -36,6 +39,18 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GCMINORINC)
+#define LUAI_GCMINORINC	20  /* young collection after heap grows 20% */
+#endif
+
+#if !defined(LUAI_GCMAJORINC)
+#define LUAI_GCMAJORINC	100  /* major collection after heap doubles */
+#endif
+
+#if !defined(LUAI_GCRATE)
+#define LUAI_GCRATE	50  /* first guess of GC work per microsecond */
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -241,13 +256,18 @@ static void preinit_thread (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaC_setstats(L, 0);
+  luaM_setprofile(L, 0);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
+#if defined(LUAI_OPPAIRSTATS)
+  luaV_printpairs(L);
+#endif
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
-  lua_assert(gettotalbytes(g) == sizeof(LG));
+  lua_assert(g->bulkfree || gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -310,6 +330,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
+  g->bulkfree = 0;
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
@@ -323,11 +344,32 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->dirtycards = NULL;
+  g->finpend = NULL;
+  g->nfinpend = g->sizefinpend = 0;
+  g->gcstats = NULL;
+  g->memprof = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
+  g->memcheck = MAX_LMEM;
+  g->memlimit[LUA_MEMSOFT] = g->memlimit[LUA_MEMHARD] = 0;
+  g->memlimitf = NULL;
+  g->memlimitud = NULL;
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcminorinc = LUAI_GCMINORINC;
+  g->gcmajorinc = LUAI_GCMAJORINC;
+  g->gcstepus = 0;
+  g->gcrate = LUAI_GCRATE;
+  g->jitrunning = LUAJ_NATIVE;
+  g->jithot = LUAI_JITHOT;
+  g->copts = 0;
+  g->hoistepoch = 0;
+#if defined(LUAI_OPPAIRSTATS)
+  g->oplastpc = NULL;
+  memset(g->oppairs, 0, sizeof(g->oppairs));
+#endif
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -10,6 +10,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "ltm.h"
 #include "lzio.h"
 
@@ -71,6 +72,7 @@ struct lua_longjmp;  /* defined in ldo.c */
 /* kinds of Garbage Collection */
 #define KGC_NORMAL	0
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+#define KGC_GEN		2	/* generational collection */
 
 
 typedef struct stringtable {
@@ -139,6 +141,10 @@ typedef struct global_State {
   void *ud;         /* auxiliary data to 'frealloc' */
   l_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
+  l_mem memcheck;  /* memory in use above which allocations check limits */
+  lu_mem memlimit[2];  /* soft and hard limits (LUA_MEM*; 0 is none) */
+  lua_MemLimit memlimitf;  /* called when a limit is crossed (or NULL) */
+  void *memlimitud;  /* auxiliary data to 'memlimitf' */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   stringtable strt;  /* hash table for strings */
@@ -148,6 +154,7 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte bulkfree;  /* true if 'frealloc' frees all with the main block */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -158,10 +165,29 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
+  GCObject **finpend;  /* objects with finalizers still in 'allgc' */
+  int nfinpend;  /* number of entries in 'finpend' */
+  int sizefinpend;  /* size of 'finpend' */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  struct Cards *dirtycards;  /* card maps of tables with dirty cards */
+  struct GCStats *gcstats;  /* collector statistics (or NULL) */
+  struct MemProf *memprof;  /* heap profiler (or NULL) */
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int gcminorinc;  /* growth (%) that triggers a young collection */
+  int gcmajorinc;  /* growth (%) that triggers a major collection */
+  int gcstepus;  /* time target (microseconds) for GC steps (0: none) */
+  l_mem gcrate;  /* GC work units done per microsecond (measured) */
+  lu_byte jitrunning;  /* true if compilation to native code is enabled */
+  int jithot;  /* calls plus back jumps that make a function hot */
+  lu_byte copts;  /* compiler options (LUA_COPT*) */
+  lua_Integer hoistepoch;  /* epoch of hoisted lookups (see 'luaV_hoist') */
+#if defined(LUAI_OPPAIRSTATS)
+  const Instruction *oplastpc;  /* last instruction executed */
+  lu_byte oplast;  /* its (regular) opcode */
+  lu_mem oppairs[NUM_OPCODES][NUM_OPCODES];  /* counts of opcode pairs */
+#endif
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
@@ -21,10 +21,21 @@
                                  (sizeof(s)/sizeof(char))-1))
 
 
+/*
+** Bit of 'extra' set in keys of hoisted lookups (see 'luaV_hoist');
+** a write to a field with such a key starts a new hoisting epoch.
+** (Reserved words and long strings never have it.)
+*/
+#define WATCHEDKEY	0x80
+
+#define iswatched(s)	((s)->extra & WATCHEDKEY)
+
+
 /*
 ** test whether a string is a reserved word
 */
-#define isreserved(s)	((s)->tt == LUA_TSHRSTR && (s)->extra > 0)
+#define isreserved(s)  \
+	((s)->tt == LUA_TSHRSTR && ((s)->extra & ~WATCHEDKEY) > 0)
 
 
 /*
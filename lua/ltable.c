@@ -21,10 +21,17 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** A key whose value becomes nil stays in its node (so that 'next' can
+** continue a traversal from it) until the next rehash, unless a new key
+** with that main position takes the node; 'hfree' counts the nodes
+** that never held a key. Large hash parts grow incrementally (see
+** 'luaH_resize'), so that a single insertion does not pay for moving
+** all entries of a big table.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -55,26 +62,30 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
-#define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
-
-#define hashstr(t,str)		hashpow2(t, (str)->hash)
-#define hashboolean(t,p)	hashpow2(t, p)
-#define hashint(t,i)		hashpow2(t, i)
-
+/*
+** Index of the main position of hash value 'n' in a hash part with
+** 'size' nodes. (The size is a parameter, so that the same macros
+** serve the old hash part of a table being resized.)
+*/
+#define hashpow2(n,size)	lmod((n), (size))
 
 /*
 ** for some types, it is better to avoid modulus by power of 2, as
 ** they tend to have many 2 factors.
 */
-#define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
-
+#define hashmod(n,size)	\
+	cast_int(cast(unsigned int, n) % ((cast(unsigned int, size) - 1) | 1))
 
-#define hashpointer(t,p)	hashmod(t, point2uint(p))
+#define hashstr(str,size)	hashpow2((str)->hash, size)
+#define hashboolean(p,size)	hashpow2(p, size)
+#define hashint(i,size)		hashpow2(i, size)
+#define hashpointer(p,size)	hashmod(point2uint(p), size)
 
+/* bytes of a hash part with 'n' nodes */
+#define hashpartsize(n)	((n) * sizeof(Node))
 
-#define dummynode		(&dummynode_)
 
-static const Node dummynode_ = {
+LUAI_DDEF const Node luaH_dummynode_ = {
   {NILCONSTANT},  /* value */
   {{NILCONSTANT, 0}}  /* key */
 };
@@ -111,31 +122,259 @@ static int l_hashfloat (lua_Number n) {
 
 
 /*
-** returns the 'main' position of an element in a table (that is, the index
-** of its hash value)
+** returns the index of the 'main' position of an element in a hash
+** part with 'size' nodes (that is, the index of its hash value)
 */
-static Node *mainposition (const Table *t, const TValue *key) {
+static int mainindex (const TValue *key, int size) {
   switch (ttype(key)) {
     case LUA_TNUMINT:
-      return hashint(t, ivalue(key));
+      return hashint(ivalue(key), size);
     case LUA_TNUMFLT:
-      return hashmod(t, l_hashfloat(fltvalue(key)));
+      return hashmod(l_hashfloat(fltvalue(key)), size);
     case LUA_TSHRSTR:
-      return hashstr(t, tsvalue(key));
+      return hashstr(tsvalue(key), size);
     case LUA_TLNGSTR:
-      return hashpow2(t, luaS_hashlongstr(tsvalue(key)));
+      return hashpow2(luaS_hashlongstr(tsvalue(key)), size);
     case LUA_TBOOLEAN:
-      return hashboolean(t, bvalue(key));
+      return hashboolean(bvalue(key), size);
     case LUA_TLIGHTUSERDATA:
-      return hashpointer(t, pvalue(key));
+      return hashpointer(pvalue(key), size);
     case LUA_TLCF:
-      return hashpointer(t, fvalue(key));
+      return hashpointer(fvalue(key), size);
     default:
       lua_assert(!ttisdeadkey(key));
-      return hashpointer(t, gcvalue(key));
+      return hashpointer(gcvalue(key), size);
+  }
+}
+
+
+#define mainposition(t,key)	gnode(t, mainindex(key, sizenode(t)))
+
+
+/*
+** Search the chain that starts at node 'n' (a variable) for a key:
+** 'eqkey' is an expression telling whether 'k' (the key of node 'n')
+** is the one being searched, in which case 'found' runs; it must leave
+** the enclosing function. Otherwise, execution continues after the
+** search.
+*/
+#define searchchain(n,k,eqkey,found)  \
+  for (;;) { \
+    const TValue *k = gkey(n); \
+    if (eqkey) found \
+    if (gnext(n) == 0) break; \
+    n += gnext(n); \
+  }
+
+
+/*
+** Search the entries of old hash part 'o' that have not moved yet, in
+** the chain starting at its node 'i'. (Moved nodes keep their links.)
+*/
+#define searchold(o,i,n,k,eqkey,found)  \
+  { Node *n = (o)->node + (i); \
+    searchchain(n, k, cast(unsigned int, n - (o)->node) >= (o)->next && \
+                      (eqkey), found) }
+
+
+/*
+** Search table 't' for a key with main position 'mp' in the hash part
+** and, while it is being resized, main position 'oldmp' in what is left
+** of the old one ('oldmp' is evaluated only in that case).
+*/
+#define searchkey(t,mp,oldmp,n,k,eqkey,found)  \
+  { { Node *n = gnode(t, mp); \
+      searchchain(n, k, eqkey, found) } \
+    if ((t)->old != NULL) \
+      searchold((t)->old, oldmp, n, k, eqkey, found) }
+
+
+/*
+** {=============================================================
+** Packed arrays
+** ==============================================================
+*/
+
+/*
+** Smallest array part worth packing. (Smaller ones hardly save memory,
+** and are more often used for heterogeneous data.)
+*/
+#define MINPACKED	8
+
+#define packedsize(n)	(offsetof(PackedArray, v) + (n) * sizeof(Value))
+
+/* whether element 'i' (in 1..sizearray) of the array part is nil */
+#define arrayisnil(t,i)  \
+	(ispacked(t) ? (i) > gpacked(t)->n : ttisnil(&(t)->array[(i) - 1]))
+
+
+/*
+** Search element 'i' of a packed array part: return a copy of it, and
+** remember 'i' in case the result is used for an assignment.
+*/
+static const TValue *getpacked (Table *t, unsigned int i) {
+  PackedArray *p = gpacked(t);
+  lua_assert(1 <= i && i <= t->sizearray);
+  p->idx = i;
+  if (i <= p->n) {
+    val_(&p->slot) = p->v[i - 1];
+    settt_(&p->slot, t->atype);
+  }
+  else
+    setnilvalue(&p->slot);
+  return &p->slot;
+}
+
+
+/* convert the packed array part of 't' to the usual tagged layout */
+static void unpackarray (lua_State *L, Table *t) {
+  PackedArray *p = gpacked(t);
+  unsigned int size = t->sizearray;
+  TValue *array = luaM_newvector(L, size, TValue);
+  unsigned int i;
+  for (i = 0; i < p->n; i++) {
+    val_(&array[i]) = p->v[i];
+    settt_(&array[i], t->atype);
+  }
+  for (; i < size; i++)
+    setnilvalue(&array[i]);
+  luaM_freemem(L, p, packedsize(size));
+  t->array = array;
+  t->atype = LUA_TNIL;
+}
+
+
+/*
+** Pack the array part of 't' if it is big enough and its non-nil values
+** are numbers of a single type, all of them before its nil values.
+*/
+static void packarray (lua_State *L, Table *t) {
+  unsigned int size = t->sizearray;
+  unsigned int n = 0;
+  unsigned int i;
+  int tt;
+  PackedArray *p;
+  lua_assert(!ispacked(t));
+  if (size < MINPACKED || !ttisnumber(&t->array[0]))
+    return;
+  tt = ttype(&t->array[0]);
+  while (n < size && ttype(&t->array[n]) == tt)
+    n++;
+  for (i = n; i < size; i++) {
+    if (!ttisnil(&t->array[i]))
+      return;  /* a value of another type */
+  }
+  p = cast(PackedArray *, luaM_malloc(L, packedsize(size)));
+  for (i = 0; i < n; i++)
+    p->v[i] = val_(&t->array[i]);
+  setnilvalue(&p->slot);
+  p->idx = 0;
+  p->n = n;
+  luaM_freearray(L, t->array, size);
+  t->array = cast(TValue *, p);
+  t->atype = cast_byte(tt);
+}
+
+
+/*
+** Assignment to the element of the packed array part of 't' last
+** searched, if it keeps the array packed: values of the array's type
+** can replace existing elements or be appended to them, and nil can
+** remove the last element. Return false (doing nothing) for other
+** assignments. (This function does not allocate memory.)
+*/
+int luaH_trysetpacked (Table *t, const TValue *v) {
+  PackedArray *p = gpacked(t);
+  unsigned int i = p->idx;
+  lua_assert(1 <= i && i <= t->sizearray);
+  if (ttisnil(v)) {
+    if (i >= p->n) {  /* not inside the sequence? */
+      if (i == p->n) p->n--;  /* remove last element */
+      return 1;
+    }
+  }
+  else if (ttype(v) == t->atype || (p->n == 0 && ttisnumber(v))) {
+    if (i <= p->n + 1) {
+      t->atype = cast_byte(ttype(v));
+      p->v[i - 1] = val_(v);
+      if (i > p->n) p->n = i;  /* appended a new element */
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Assignment to the element of the packed array part of 't' last
+** searched; assignments that do not fit the packed layout unpack the
+** array.
+*/
+void luaH_setpacked (lua_State *L, Table *t, const TValue *v) {
+  unsigned int i = gpacked(t)->idx;
+  if (!luaH_trysetpacked(t, v)) {
+    unpackarray(L, t);
+    setobj2t(L, &t->array[i - 1], v);
+  }
+}
+
+
+/*
+** Smallest array part packed when it gets its first element. Packing
+** then costs one more allocation, which smaller array parts (often
+** from constructors that run many times) do not pay back.
+*/
+#define MINPACKFIRST	128
+
+
+/*
+** Assign number 'v' to the first element of the array part of 't',
+** which is not packed and where that element is nil; then pack the
+** array part, if it is big enough and can be packed now.
+*/
+void luaH_setfirst (lua_State *L, Table *t, const TValue *v) {
+  lua_assert(!ispacked(t) && ttisnil(&t->array[0]) && ttisnumber(v));
+  setobj2t(L, &t->array[0], v);
+  if (t->sizearray >= MINPACKFIRST)
+    packarray(L, t);
+}
+
+
+/*
+** Assign the 'n' values in 'v' to elements 'first' + 1 to 'first' + n
+** of 't', for a table constructor: the array part has room for them,
+** and its elements from 'first' + 1 on are nil. A constructor whose
+** first values are numbers of a single type packs a large array part,
+** and numbers of that type go straight into a packed one.
+*/
+void luaH_setlist (lua_State *L, Table *t, unsigned int first,
+                                 const TValue *v, int n) {
+  int j = 0;
+  lua_assert(first + n <= t->sizearray);
+  if (first == 0 && n > 0 && !ispacked(t) && ttisnumber(v) &&
+      t->sizearray >= MINPACKFIRST) {
+    while (j < n && ttype(&v[j]) == ttype(v))
+      j++;
+    if (j == n)  /* all values pack? */
+      luaH_setfirst(L, t, v);
+    j = 0;
+  }
+  if (ispacked(t)) {
+    PackedArray *p = gpacked(t);
+    for (; j < n && first + j == p->n && ttype(&v[j]) == t->atype; j++)
+      p->v[p->n++] = val_(&v[j]);
+  }
+  for (; j < n; j++) {
+    if (ispacked(t))
+      luaH_setint(L, t, first + j + 1, cast(TValue *, &v[j]));
+    else
+      setobj2t(L, &t->array[first + j], &v[j]);
+    luaC_barrierback(L, t, &v[j]);
   }
 }
 
+/* }============================================================= */
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -156,6 +395,10 @@ static unsigned int arrayindex (const TValue *key) {
 ** elements in the array part, then elements in the hash part. The
 ** beginning of a traversal is signaled by 0.
 */
+#define samekey(k,key)  \
+	(luaV_rawequalobj(k, key) || \
+	 (ttisdeadkey(k) && iscollectable(key) && deadvalue(k) == gcvalue(key)))
+
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
@@ -163,28 +406,50 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
-    int nx;
-    Node *n = mainposition(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||
-            (ttisdeadkey(gkey(n)) && iscollectable(key) &&
-             deadvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+    unsigned int size = allocsizenode(t);
+    OldNodes *o = t->old;
+    /* in a traversal, 'key' is usually the last key returned */
+    i = t->lastnext - t->sizearray - 1;  /* its index in hash table */
+    if (i < size) {
+      if (samekey(gkey(gnode(t, i)), key))
+        return t->lastnext;
+    }
+    else if (o != NULL && i - size >= o->next && i - size < o->size &&
+             samekey(gkey(o->node + (i - size)), key))
+      return t->lastnext;
+    /* key may be dead already, but it is ok to use it in 'next' */
+    { Node *n = mainposition(t, key);
+      searchchain(n, k, samekey(k, key), {
+        i = cast(unsigned int, n - gnode(t, 0));  /* key index in hash table */
         /* hash elements are numbered after array ones */
         return (i + 1) + t->sizearray;
-      }
-      nx = gnext(n);
-      if (nx == 0)
-        luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-      else n += nx;
+      })
     }
+    if (o != NULL) {
+      /* old hash elements are numbered after new ones */
+      searchold(o, mainindex(key, o->size), n, k, samekey(k, key), {
+        i = cast(unsigned int, n - o->node);
+        return (i + 1) + size + t->sizearray;
+      })
+    }
+    luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return 0;  /* to avoid warnings */
   }
 }
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
   unsigned int i = findindex(L, t, key);  /* find original element */
+  unsigned int size;
+  if (ispacked(t)) {
+    if (i < gpacked(t)->n) {  /* a non-nil value? */
+      setivalue(key, i + 1);
+      setobj2s(L, key+1, getpacked(t, i + 1));
+      return 1;
+    }
+    if (i < t->sizearray)
+      i = t->sizearray;  /* the rest of the array part is nil */
+  }
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
       setivalue(key, i + 1);
@@ -192,13 +457,30 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
-  for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
+  size = allocsizenode(t);
+  for (i -= t->sizearray; i < size; i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      t->lastnext = (i + 1) + t->sizearray;  /* remember its position */
       return 1;
     }
   }
+  if (t->old != NULL) {  /* then entries not moved from old hash part */
+    OldNodes *o = t->old;
+    i -= size;
+    if (i < o->next)
+      i = o->next;  /* previous nodes have moved */
+    for (; i < o->size; i++) {
+      Node *n = o->node + i;
+      if (!ttisnil(gval(n))) {
+        setobj2s(L, key, gkey(n));
+        setobj2s(L, key+1, gval(n));
+        t->lastnext = (i + 1) + size + t->sizearray;
+        return 1;
+      }
+    }
+  }
   return 0;  /* no more elements */
 }
 
@@ -272,7 +554,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
     }
     /* count elements in range (2^(lg - 1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (!arrayisnil(t, i))
         lc++;
     }
     nums[lg] += lc;
@@ -285,7 +567,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
 static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
   int totaluse = 0;  /* total number of elements */
   int ause = 0;  /* elements added to 'nums' (can go to array part) */
-  int i = sizenode(t);
+  int i = allocsizenode(t);
   while (i--) {
     Node *n = &t->node[i];
     if (!ttisnil(gval(n))) {
@@ -300,18 +582,124 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 
 static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
   unsigned int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
-  for (i=t->sizearray; i<size; i++)
-     setnilvalue(&t->array[i]);
+  if (ispacked(t)) {  /* new elements are implicitly nil */
+    lua_assert(gpacked(t)->n <= size);
+    t->array = cast(TValue *, luaM_realloc_(L, t->array,
+                    packedsize(t->sizearray), packedsize(size)));
+  }
+  else {
+    luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
+    for (i=t->sizearray; i<size; i++)
+       setnilvalue(&t->array[i]);
+  }
   t->sizearray = size;
 }
 
 
+/*
+** Check whether a resize of 't' moves some key from its hash part into
+** its (new) array part of size 'nasize'.
+*/
+static int movestoarray (const Table *t, unsigned int nasize) {
+  int i = allocsizenode(t);
+  while (i--) {
+    Node *n = gnode(t, i);
+    if (!ttisnil(gval(n))) {
+      unsigned int k = arrayindex(gkey(n));
+      if (k != 0 && k <= nasize)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Get a free node of 't' (one that never held a key); there must be
+** some ('hfree' > 0).
+*/
+static Node *getfreepos (Table *t) {
+  lua_assert(t->hfree > 0);
+  for (;;) {  /* (there is a free position before 'lastfree') */
+    t->lastfree--;
+    if (ttisnil(gkey(t->lastfree))) {
+      t->hfree--;
+      return t->lastfree;
+    }
+  }
+}
+
+
+/*
+** Find a node for a new key, which must not be in the table, and set
+** the key there (the caller sets its value). First, check whether the
+** key's main position is free, or holds a removed entry. If not, check
+** whether colliding node is in its main position or not: if it is not,
+** move colliding node to an empty place and put new key in its main
+** position; otherwise (colliding node is in its main position), new key
+** goes to an empty position. Unless the main position is available,
+** there must be some free node ('hfree' > 0).
+*/
+static Node *newpos (lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
+  if (!ttisnil(gval(mp))) {  /* main position is taken? */
+    Node *othern;
+    Node *f = getfreepos(t);  /* get a free place */
+    othern = mainposition(t, gkey(mp));
+    if (othern != mp) {  /* is colliding node out of its main position? */
+      /* yes; move colliding node into free position */
+      while (othern + gnext(othern) != mp)  /* find previous */
+        othern += gnext(othern);
+      gnext(othern) = cast_int(f - othern);  /* rechain to point to 'f' */
+      *f = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
+      luaC_barrierslot(L, t, gkey(f), gkey(f));
+      luaC_barrierslot(L, t, gval(f), gval(f));
+      if (gnext(mp) != 0) {
+        gnext(f) += cast_int(mp - f);  /* correct 'next' */
+        gnext(mp) = 0;  /* now 'mp' is free */
+      }
+      setnilvalue(gval(mp));
+    }
+    else {  /* colliding node is in its own main position */
+      /* new node will go into free position */
+      if (gnext(mp) != 0)
+        gnext(f) = cast_int((mp + gnext(mp)) - f);  /* chain new position */
+      else lua_assert(gnext(f) == 0);
+      gnext(mp) = cast_int(f - mp);
+      mp = f;
+    }
+  }
+  else if (ttisnil(gkey(mp)))  /* main position is free? */
+    t->hfree--;
+  setnodekey(L, &mp->i_key, key);
+  return mp;
+}
+
+
+/*
+** A table created for a small hash part, such as a record built by a
+** constructor, gets room for it in its own memory block, right after
+** the 'Table' structure, saving an allocation and its overhead. 'lsmall'
+** is 1 plus the log2 of the number of nodes in that room (or 0 when the
+** table has no room). A hash part that fits there uses it, unless it is
+** replacing the one there; so, a hash part that grows moves to a block
+** of its own, and may come back if a later rehash shrinks it.
+*/
+#define LMAXSMALL	3	/* log2 of the maximum room for nodes */
+
+#define smallnodes(t)	cast(Node *, (t) + 1)
+
+/* size of the block of table 't' */
+#define tablesize(t)  (sizeof(Table) + \
+	((t)->lsmall == 0 ? 0 : hashpartsize(twoto((t)->lsmall - 1))))
+
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
     t->lastfree = NULL;  /* signal that it is using dummy node */
+    t->hfree = 0;  /* any insertion must rehash */
   }
   else {
     int i;
@@ -319,7 +707,10 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
+    if (lsize < t->lsmall && t->node != smallnodes(t))  /* fits in table? */
+      t->node = smallnodes(t);
+    else
+      t->node = cast(Node *, luaM_malloc(L, hashpartsize(size)));
     for (i = 0; i < (int)size; i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -328,6 +719,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     }
     t->lsizenode = cast_byte(lsize);
     t->lastfree = gnode(t, size);  /* all positions are free */
+    t->hfree = size;
   }
 }
 
@@ -344,43 +736,165 @@ static void auxsetnode (lua_State *L, void *ud) {
 }
 
 
+static void freeold (lua_State *L, Table *t) {
+  lua_assert(t->old->node != smallnodes(t));
+  luaM_freemem(L, t->old->node, hashpartsize(cast(size_t, t->old->size)));
+  luaM_free(L, t->old);
+  t->old = NULL;
+}
+
+
+/*
+** Move to the hash part of 't' the entries in the next 'n' nodes of its
+** old hash part; free the old hash part once all of them have moved.
+** (Entries are all distinct and not in the new hash part, so they need
+** no search.)
+*/
+static void moveold (lua_State *L, Table *t, unsigned int n) {
+  OldNodes *o = t->old;
+  unsigned int lim = (n < o->size - o->next) ? o->next + n : o->size;
+  for (; o->next < lim; o->next++) {
+    Node *old = o->node + o->next;
+    if (!ttisnil(gval(old))) {
+      Node *nn = newpos(L, t, gkey(old));
+      setobj(L, gval(nn), gval(old));
+    }
+  }
+  if (o->next == o->size)  /* all entries moved? */
+    freeold(L, t);
+}
+
+
+/* complete the resize of the hash part of 't', if any */
+#define finishmove(L,t)	{ if ((t)->old != NULL) moveold(L, t, MAX_INT); }
+
+
+/* re-insert into 't' the entries of its former hash part 'nold' */
+static void reinsert (lua_State *L, Table *t, Node *nold, int oldhsize) {
+  int j;
+  for (j = 0; j < oldhsize; j++) {
+    Node *old = nold + j;
+    if (!ttisnil(gval(old))) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      const TValue *key = gkey(old);
+      unsigned int k = arrayindex(key);
+      TValue *cell;
+      if (k != 0 && k <= t->sizearray) {
+        lua_assert(!ispacked(t));
+        cell = &t->array[k - 1];
+      }
+      else  /* keys are all distinct: no need to search for them */
+        cell = gval(newpos(L, t, key));
+      setobjt2t(L, cell, gval(old));
+    }
+  }
+  if (oldhsize > 0 && nold != smallnodes(t))  /* has a block of its own? */
+    luaM_freemem(L, nold, hashpartsize(cast(size_t, oldhsize)));
+}
+
+
+/*
+** Hash parts with at least MINMOVE nodes are resized incrementally, when
+** the array part does not change. Each insertion then moves the entries
+** of at least MOVESTEP old nodes; more when the new hash part could fill
+** up before all old entries move. While a move lasts, every search for
+** an absent key (so every insertion) also misses in the old hash part,
+** so it is better for the move to take a few large steps than many small
+** ones: the cost of each step stays bounded, and fewer insertions pay
+** that extra miss. (Searches for keys not yet moved miss in the new
+** hash part first, too, so the move should end soon even when the
+** table stops growing.)
+*/
+#define MINMOVE		(1u << 15)
+#define MOVESTEP	1024
+
+
+/*
+** Try to start an incremental resize of 't', whose new hash part is
+** already allocated, with old hash part 'nold' of 'oldhsize' nodes, of
+** which 'oldused' are in use. As each insertion takes a free node,
+** the entries of all old nodes must move before 'hfree - oldused'
+** insertions (after that, the new part may not have room for all old
+** entries); give up if that needs too many moves per insertion.
+*/
+static int startmove (Table *t, OldNodes *o, Node *nold,
+                      unsigned int oldhsize, unsigned int oldused) {
+  unsigned int step;
+  if (t->hfree <= oldused)
+    return 0;
+  step = oldhsize / (t->hfree - oldused) + 1;
+  if (step > oldhsize / 8)
+    return 0;
+  o->node = nold;
+  o->size = oldhsize;
+  o->next = 0;
+  o->step = (step < MOVESTEP) ? MOVESTEP : step;
+  t->old = o;
+  return 1;
+}
+
+
 void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
-  int j;
   AuxsetnodeT asn;
-  unsigned int oldasize = t->sizearray;
-  int oldhsize = allocsizenode(t);
-  Node *nold = t->node;  /* save old hash ... */
+  unsigned int oldasize;
+  int oldhsize;
+  unsigned int oldused;
+  Node *nold;
+  OldNodes *o = NULL;
+  luaC_tablemoved(t);
+  finishmove(L, t);  /* complete a previous resize */
+  oldhsize = allocsizenode(t);
+  oldused = cast(unsigned int, oldhsize) - t->hfree;
+  nold = t->node;  /* save old hash ... */
+  if (ispacked(t) && (nasize == 0 || movestoarray(t, nasize)))
+    unpackarray(L, t);  /* keep reinsertions simple */
+  oldasize = t->sizearray;
+  if (nasize == oldasize && cast(unsigned int, oldhsize) >= MINMOVE)
+    o = luaM_new(L, OldNodes);  /* may resize incrementally */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
   asn.t = t; asn.nhsize = nhsize;
   if (luaD_rawrunprotected(L, auxsetnode, &asn) != LUA_OK) {  /* mem. error? */
     setarrayvector(L, t, oldasize);  /* array back to its original size */
+    if (o != NULL) luaM_free(L, o);
     luaD_throw(L, LUA_ERRMEM);  /* rethrow memory error */
   }
   if (nasize < oldasize) {  /* array part must shrink? */
     t->sizearray = nasize;
-    /* re-insert elements from vanishing slice */
-    for (i=nasize; i<oldasize; i++) {
-      if (!ttisnil(&t->array[i]))
-        luaH_setint(L, t, i + 1, &t->array[i]);
+    if (ispacked(t)) {
+      PackedArray *p = gpacked(t);
+      /* re-insert elements from vanishing slice */
+      for (i=nasize; i<p->n; i++) {
+        TValue v;
+        val_(&v) = p->v[i];
+        settt_(&v, t->atype);
+        luaH_setint(L, t, i + 1, &v);
+      }
+      if (p->n > nasize) p->n = nasize;
+      /* shrink array */
+      t->array = cast(TValue *, luaM_realloc_(L, t->array,
+                      packedsize(oldasize), packedsize(nasize)));
     }
-    /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
-  }
-  /* re-insert elements from hash part */
-  for (j = oldhsize - 1; j >= 0; j--) {
-    Node *old = nold + j;
-    if (!ttisnil(gval(old))) {
-      /* doesn't need barrier/invalidate cache, as entry was
-         already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
+    else {
+      /* re-insert elements from vanishing slice */
+      for (i=nasize; i<oldasize; i++) {
+        if (!ttisnil(&t->array[i]))
+          luaH_setint(L, t, i + 1, &t->array[i]);
+      }
+      /* shrink array */
+      luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
     }
   }
-  if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+  if (o == NULL || !startmove(t, o, nold, oldhsize, oldused)) {
+    if (o != NULL) luaM_free(L, o);
+    reinsert(L, t, nold, oldhsize);
+  }
+  if (!ispacked(t))
+    packarray(L, t);
 }
 
 
@@ -389,6 +903,103 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Make room in 't' for at least 'nasize' array elements and 'nhsize'
+** keys in its hash part, so that filling it up to those sizes does not
+** rehash. Parts that are already large enough are kept.
+*/
+void luaH_reserve (lua_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  unsigned int size, used;
+  finishmove(L, t);
+  size = allocsizenode(t);
+  used = size - t->hfree;
+  if (nasize < t->sizearray)
+    nasize = t->sizearray;
+  if (size > 0 && size >= nhsize)
+    nhsize = size;  /* hash part is big enough; keep it */
+  else if (nhsize < used)
+    nhsize = used;
+  if (nasize != t->sizearray || nhsize != size)
+    luaH_resize(L, t, nasize, nhsize);
+}
+
+
+/*
+** Remove all entries from 't', keeping its array and hash parts for
+** reuse. (Like adding keys, this invalidates ongoing traversals.)
+*/
+void luaH_clear (lua_State *L, Table *t) {
+  unsigned int i;
+  if (t->old != NULL)
+    freeold(L, t);  /* drop entries of old hash part */
+  if (ispacked(t))
+    gpacked(t)->n = 0;
+  else {
+    for (i = 0; i < t->sizearray; i++)
+      setnilvalue(&t->array[i]);
+  }
+  if (!isdummy(t)) {
+    unsigned int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);
+    t->hfree = size;
+  }
+  t->lenhint = 0;
+  t->lastnext = 0;
+}
+
+
+/*
+** Copy the contents and metatable of table 't' to the new (empty) table
+** 'c'. Positions in a hash part depend only on its keys and size (and
+** chains link nodes by offsets), so both parts are copied as they are,
+** in bulk. Entries not yet moved out of an old hash part of 't' are
+** inserted as new keys, for which there is room (see 'startmove'). 'c'
+** is new, so it needs no barriers.
+*/
+void luaH_copy (lua_State *L, Table *c, Table *t) {
+  unsigned int size = t->sizearray;
+  lua_assert(c->sizearray == 0 && isdummy(c));
+  if (size > 0) {
+    if (ispacked(t)) {
+      c->array = cast(TValue *, luaM_malloc(L, packedsize(size)));
+      memcpy(c->array, t->array, packedsize(size));
+      c->atype = t->atype;
+    }
+    else {
+      c->array = luaM_newvector(L, size, TValue);
+      memcpy(c->array, t->array, size * sizeof(TValue));
+    }
+    c->sizearray = size;
+  }
+  if (!isdummy(t)) {
+    size = sizenode(t);
+    setnodevector(L, c, size);  /* same size as in 't' */
+    lua_assert(sizenode(c) == cast_int(size));
+    memcpy(c->node, t->node, hashpartsize(size));
+    c->lastfree = c->node + (t->lastfree - t->node);
+    c->hfree = t->hfree;
+    if (t->old != NULL) {
+      OldNodes *o = t->old;
+      for (size = o->next; size < o->size; size++) {
+        Node *old = o->node + size;
+        if (!ttisnil(gval(old)))
+          setobj(L, gval(newpos(L, c, gkey(old))), gval(old));
+      }
+    }
+  }
+  c->lenhint = t->lenhint;
+  c->metatable = t->metatable;
+  c->flags = t->flags;
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -407,8 +1018,10 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   totaluse++;
   /* compute new size for array part */
   asize = computesizes(nums, &na);
-  /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, totaluse - na);
+  /* resize the table to new computed sizes. The hash part gets room for
+     1/4 more keys: a table that fills up with removed entries (see
+     'newpos') must not rehash to the same size after a few insertions */
+  luaH_resize(L, t, asize, (totaluse - na) + (totaluse - na) / 4);
 }
 
 
@@ -418,11 +1031,19 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 */
 
 
-Table *luaH_new (lua_State *L) {
-  GCObject *o = luaC_newobj(L, LUA_TTABLE, sizeof(Table));
+static Table *newtable (lua_State *L, int lsmall) {
+  size_t size = (lsmall == 0) ? sizeof(Table)
+              : sizeof(Table) + hashpartsize(twoto(lsmall - 1));
+  GCObject *o = luaC_newobj(L, LUA_TTABLE, size);
   Table *t = gco2t(o);
+  t->lsmall = cast_byte(lsmall);
   t->metatable = NULL;
   t->flags = cast_byte(~0);
+  t->atype = LUA_TNIL;
+  t->lenhint = 0;
+  t->lastnext = 0;
+  t->old = NULL;
+  t->cards = NULL;
   t->array = NULL;
   t->sizearray = 0;
   setnodevector(L, t, 0);
@@ -430,36 +1051,43 @@ Table *luaH_new (lua_State *L) {
 }
 
 
-void luaH_free (lua_State *L, Table *t) {
-  if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
-  luaM_freearray(L, t->array, t->sizearray);
-  luaM_free(L, t);
+Table *luaH_new (lua_State *L) {
+  return newtable(L, 0);
 }
 
 
-static Node *getfreepos (Table *t) {
-  if (!isdummy(t)) {
-    while (t->lastfree > t->node) {
-      t->lastfree--;
-      if (ttisnil(gkey(t->lastfree)))
-        return t->lastfree;
-    }
-  }
-  return NULL;  /* could not find a free place */
+/*
+** Create a table with room for a hash part of 'nhsize' keys, if that is
+** small enough. (The hash part itself is created by 'luaH_resize', after
+** the caller has anchored the table.)
+*/
+Table *luaH_newsized (lua_State *L, int nhsize) {
+  if (0 < nhsize && nhsize <= twoto(LMAXSMALL))
+    return newtable(L, luaO_ceillog2(cast(unsigned int, nhsize)) + 1);
+  else
+    return newtable(L, 0);
 }
 
 
+void luaH_free (lua_State *L, Table *t) {
+  if (t->old != NULL)
+    freeold(L, t);
+  if (!isdummy(t) && t->node != smallnodes(t))
+    luaM_freemem(L, t->node, hashpartsize(cast(size_t, sizenode(t))));
+  if (ispacked(t))
+    luaM_freemem(L, t->array, packedsize(t->sizearray));
+  else
+    luaM_freearray(L, t->array, t->sizearray);
+  luaM_freemem(L, t, tablesize(t));
+}
+
 
 /*
-** inserts a new key into a hash table; first, check whether key's main
-** position is free. If not, check whether colliding node is in its main
-** position or not: if it is not, move colliding node to an empty place and
-** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** inserts a new key into a hash table (see 'newpos'); if the table
+** cannot take more keys, rehash it.
 */
 TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp;
+  Node *n;
   TValue aux;
   if (ttisnil(key)) luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
@@ -471,42 +1099,21 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
     else if (luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
   }
-  mp = mainposition(t, key);
-  if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
-    Node *othern;
-    Node *f = getfreepos(t);  /* get a free place */
-    if (f == NULL) {  /* cannot find a free place? */
+  if (t->old != NULL)  /* hash part being resized? */
+    moveold(L, t, t->old->step);  /* move some more old entries */
+  if (t->hfree == 0) {  /* no free node? */
+    Node *mp = mainposition(t, key);
+    if (!ttisnil(gval(mp)) || ttisnil(gkey(mp))) {  /* key needs one? */
+      lua_assert(t->old == NULL);  /* (old entries move before that) */
       rehash(L, t, key);  /* grow table */
       /* whatever called 'newkey' takes care of TM cache */
       return luaH_set(L, t, key);  /* insert key into grown table */
     }
-    lua_assert(!isdummy(t));
-    othern = mainposition(t, gkey(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (othern + gnext(othern) != mp)  /* find previous */
-        othern += gnext(othern);
-      gnext(othern) = cast_int(f - othern);  /* rechain to point to 'f' */
-      *f = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      if (gnext(mp) != 0) {
-        gnext(f) += cast_int(mp - f);  /* correct 'next' */
-        gnext(mp) = 0;  /* now 'mp' is free */
-      }
-      setnilvalue(gval(mp));
-    }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      if (gnext(mp) != 0)
-        gnext(f) = cast_int((mp + gnext(mp)) - f);  /* chain new position */
-      else lua_assert(gnext(f) == 0);
-      gnext(mp) = cast_int(f - mp);
-      mp = f;
-    }
   }
-  setnodekey(L, &mp->i_key, key);
-  luaC_barrierback(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+  n = newpos(L, t, key);
+  luaC_barrierslot(L, t, gkey(n), key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
 }
 
 
@@ -516,18 +1123,11 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
 const TValue *luaH_getint (Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1 < t->sizearray)
-    return &t->array[key - 1];
+    return ispacked(t) ? getpacked(t, cast(unsigned int, key))
+                       : &t->array[key - 1];
   else {
-    Node *n = hashint(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
-        return gval(n);  /* that's it */
-      else {
-        int nx = gnext(n);
-        if (nx == 0) break;
-        n += nx;
-      }
-    }
+    searchkey(t, hashint(key, sizenode(t)), hashint(key, t->old->size),
+              n, k, ttisinteger(k) && ivalue(k) == key, return gval(n);)
     return luaO_nilobject;
   }
 }
@@ -537,19 +1137,30 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
-  for (;;) {  /* check whether 'key' is somewhere in the chain */
-    const TValue *k = gkey(n);
-    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
-      return gval(n);  /* that's it */
-    else {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
-      n += nx;
-    }
+  searchkey(t, hashstr(key, sizenode(t)), hashstr(key, t->old->size), n, k,
+            ttisshrstring(k) && eqshrstr(tsvalue(k), key), return gval(n);)
+  return luaO_nilobject;  /* not found */
+}
+
+
+/*
+** slow path of 'luaH_getcached': search for 'key' and, if it is
+** present, remember its node in 'hint'
+*/
+const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                    unsigned int *hint) {
+  Node *n = gnode(t, hashstr(key, sizenode(t)));
+  lua_assert(key->tt == LUA_TSHRSTR);
+  searchchain(n, k, ttisshrstring(k) && eqshrstr(tsvalue(k), key), {
+    *hint = cast(unsigned int, n - gnode(t, 0));
+    return gval(n);
+  })
+  if (t->old != NULL) {  /* keys still in an old hash part get no hint */
+    searchold(t->old, hashstr(key, t->old->size), o, k,
+              ttisshrstring(k) && eqshrstr(tsvalue(k), key), return gval(o);)
   }
+  return luaO_nilobject;  /* not found */
 }
 
 
@@ -558,17 +1169,9 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
-  Node *n = mainposition(t, key);
-  for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (luaV_rawequalobj(gkey(n), key))
-      return gval(n);  /* that's it */
-    else {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
-      n += nx;
-    }
-  }
+  searchkey(t, mainindex(key, sizenode(t)), mainindex(key, t->old->size),
+            n, k, luaV_rawequalobj(k, key), return gval(n);)
+  return luaO_nilobject;  /* not found */
 }
 
 
@@ -625,7 +1228,7 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
     setivalue(&k, key);
     cell = luaH_newkey(L, t, &k);
   }
-  setobj2t(L, cell, value);
+  luaH_setnewslot(L, t, cell, value);
 }
 
 
@@ -653,26 +1256,78 @@ static lua_Unsigned unbound_search (Table *t, lua_Unsigned j) {
 }
 
 
+/*
+** Search for a boundary in the array part of 't', whose last element
+** ('j') is nil. Boundaries move little between calls in the usual
+** patterns (filling an array, using it as a stack), so the search
+** first checks the last boundary found and its neighbours.
+*/
+static unsigned int arrayborder (Table *t, unsigned int j) {
+  unsigned int i = 0;
+  unsigned int h = t->lenhint;
+  if (h < j) {  /* hint inside the array part? */
+    if (h == 0 || !ttisnil(&t->array[h - 1])) {  /* t[h] is present? */
+      if (ttisnil(&t->array[h]))  /* and t[h + 1] is nil? */
+        return h;  /* hint is still a boundary */
+      else if (ttisnil(&t->array[h + 1]))  /* t[h + 2] is nil? */
+        return t->lenhint = h + 1;  /* boundary grew by one */
+      i = h + 1;
+    }
+    else if (h == 1 || !ttisnil(&t->array[h - 2]))  /* t[h - 1] present? */
+      return t->lenhint = h - 1;  /* boundary shrank by one */
+    else
+      j = h - 1;
+  }
+  /* binary search between 'i' (zero or present) and 'j' (nil) */
+  while (j - i > 1) {
+    unsigned int m = (i+j)/2;
+    if (ttisnil(&t->array[m - 1])) j = m;
+    else i = m;
+  }
+  return t->lenhint = i;
+}
+
+
+/*
+** Search for a boundary in the hash part of 't', given that 'j' is
+** zero or present; as in 'arrayborder', try the last boundary found
+** first.
+*/
+static lua_Unsigned hashborder (Table *t, unsigned int j) {
+  lua_Unsigned b;
+  unsigned int h = t->lenhint;
+  if (h > j && !ttisnil(luaH_getint(t, h))) {  /* t[h] is present? */
+    if (ttisnil(luaH_getint(t, l_castU2S(l_castS2U(h) + 1))))
+      return h;  /* hint is still a boundary */
+    else if (ttisnil(luaH_getint(t, l_castU2S(l_castS2U(h) + 2))))
+      b = l_castS2U(h) + 1;  /* boundary grew by one */
+    else
+      b = unbound_search(t, h);
+  }
+  else
+    b = unbound_search(t, j);
+  if (b <= UINT_MAX)
+    t->lenhint = cast(unsigned int, b);
+  return b;
+}
+
+
 /*
 ** Try to find a boundary in table 't'. A 'boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
 */
 lua_Unsigned luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
-    /* there is a boundary in the array part: (binary) search for it */
-    unsigned int i = 0;
-    while (j - i > 1) {
-      unsigned int m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1])) j = m;
-      else i = m;
-    }
-    return i;
+  if (ispacked(t)) {
+    if (gpacked(t)->n < j)  /* is there a nil in the array part? */
+      return gpacked(t)->n;  /* that is the boundary */
   }
+  else if (j > 0 && ttisnil(&t->array[j - 1]))
+    return arrayborder(t, j);  /* there is a boundary in the array part */
   /* else must find a boundary in hash part */
-  else if (isdummy(t))  /* hash part is empty? */
+  if (isdummy(t))  /* hash part is empty? */
     return j;  /* that is easy... */
-  else return unbound_search(t, j);
+  else return hashborder(t, j);
 }
 
 
@@ -27,31 +27,121 @@
 #define invalidateTMcache(t)	((t)->flags = 0)
 
 
+/*
+** The array part of a table holding only integers or only floats can
+** be packed: 'array' then points to a 'PackedArray', which keeps the
+** values without their tags ('atype' is the tag of all of them). As
+** there is no tagged value to point to, the search functions return a
+** copy of a packed element in field 'slot'; assignments through such
+** a result must use 'luaH_setslot'.
+*/
+typedef struct PackedArray {
+  TValue slot;  /* copy of element 'idx' */
+  unsigned int idx;  /* index of the last element searched */
+  unsigned int n;  /* elements 1..n are not nil, all others are nil */
+  Value v[1];  /* elements */
+} PackedArray;
+
+#define ispacked(t)	((t)->atype != LUA_TNIL)
+#define gpacked(t)	cast(PackedArray *, (t)->array)
+
+/* number of tagged values in the array part (for the collector) */
+#define sizetvarray(t)	(ispacked(t) ? 0 : (t)->sizearray)
+
+
+/*
+** Assign 'v' through 'o', a result of a search (or of 'luaH_set' or
+** 'luaH_newkey') in table 't'.
+*/
+#define luaH_setslot(L,t,o,v) \
+  (ispacked(t) && (o) == &gpacked(t)->slot \
+    ? luaH_setpacked(L, t, v) \
+    : (void)setobj2t(L, cast(TValue *, o), v))
+
+
+/*
+** 'luaH_setslot' for assignments that may create an element (through a
+** nil 'o'). A number stored in a nil first element of a large array
+** part that is not packed may pack it: array parts presized by
+** 'lua_createtable', 'table.new', or constructors get their elements
+** only after 'luaH_resize' tried to pack them.
+*/
+#define luaH_setnewslot(L,t,o,v) \
+  (!ispacked(t) && (o) == (t)->array && ttisnil(o) && ttisnumber(v) \
+    ? luaH_setfirst(L, t, v) \
+    : luaH_setslot(L, t, o, v))
+
+
+/*
+** A large hash part is resized incrementally: the new hash part takes
+** all new keys at once, while the entries of the old one move to it a
+** few nodes at each insertion. Meanwhile, 'old' describes the old hash
+** part, whose nodes from 'next' on still hold entries.
+*/
+typedef struct OldNodes {
+  Node *node;
+  unsigned int size;  /* number of nodes */
+  unsigned int next;  /* first node whose entry has not moved yet */
+  unsigned int step;  /* nodes to move at each insertion */
+} OldNodes;
+
+
 /* true when 't' is using 'dummynode' as its hash part */
-#define isdummy(t)		((t)->lastfree == NULL)
+#define isdummy(t)		((t)->node == dummynode)
+
+#define dummynode		(&luaH_dummynode_)
 
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** Search for short string 'key' using an inline cache: '*hint' is the
+** node where an instruction last found its key, so a repeated access
+** costs a single key comparison. Misses go through the regular search,
+** which refreshes the hint. A stale hint (after a rehash, or when the
+** instruction sees another table) just causes a miss.
+*/
+#define luaH_getcached(t,key,hint) \
+  (ttisshrstring(gkey(gnode(t, lmod(*(hint), sizenode(t))))) && \
+   tsvalue(gkey(gnode(t, lmod(*(hint), sizenode(t))))) == (key) \
+   ? gval(gnode(t, lmod(*(hint), sizenode(t)))) \
+   : luaH_getshortstrhint(t, key, hint))
+
+
 /* returns the key, given the value of a table entry */
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
 
 
+LUAI_DDEC const Node luaH_dummynode_;
+
+
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                                        unsigned int *hint);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
+LUAI_FUNC int luaH_trysetpacked (Table *t, const TValue *v);
+LUAI_FUNC void luaH_setpacked (lua_State *L, Table *t, const TValue *v);
+LUAI_FUNC void luaH_setfirst (lua_State *L, Table *t, const TValue *v);
+LUAI_FUNC void luaH_setlist (lua_State *L, Table *t, unsigned int first,
+                                           const TValue *v, int n);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+LUAI_FUNC Table *luaH_newsized (lua_State *L, int nhsize);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_reserve (lua_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
+LUAI_FUNC void luaH_clear (lua_State *L, Table *t);
+LUAI_FUNC void luaH_copy (lua_State *L, Table *c, Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
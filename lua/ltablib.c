@@ -223,6 +223,102 @@ static int unpack (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Presizing
+** =======================================================
+*/
+
+/* get optional size argument 'arg' */
+static int checksize (lua_State *L, int arg) {
+  lua_Integer n = luaL_optinteger(L, arg, 0);
+  luaL_argcheck(L, 0 <= n && n < INT_MAX, arg, "invalid size");
+  return (int)n;
+}
+
+
+static int tnew (lua_State *L) {
+  int narr = checksize(L, 1);
+  int nrec = checksize(L, 2);
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+static int treserve (lua_State *L) {
+  int narr = checksize(L, 2);
+  int nrec = checksize(L, 3);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_reservetable(L, 1, narr, nrec);
+  lua_settop(L, 1);
+  return 1;  /* return table */
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
+/*
+** Deep clone: replace the table values in the clones of the queue at
+** index 3 by their clones, cloning each table once (the table at index
+** 2 maps tables to their clones), so that the copy keeps the shape of
+** the original, cycles included. Keys and metatables are not cloned.
+** (A queue, unlike recursion, has no limit on the depth of tables.)
+*/
+static void deepclone (lua_State *L) {
+  lua_Integer head = 1, tail = 1;
+  for (; head <= tail; head++) {
+    lua_rawgeti(L, 3, head);  /* clone to fix */
+    lua_pushnil(L);
+    while (lua_next(L, 5)) {
+      if (lua_type(L, -1) == LUA_TTABLE) {
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, 2) == LUA_TNIL) {  /* not cloned yet? */
+          lua_pop(L, 1);
+          lua_clonetable(L, -1);
+          lua_pushvalue(L, -2);  /* original */
+          lua_pushvalue(L, -2);  /* clone */
+          lua_rawset(L, 2);  /* map original to clone */
+          lua_pushvalue(L, -1);
+          lua_rawseti(L, 3, ++tail);  /* must fix it too */
+        }
+        lua_pushvalue(L, -3);  /* key */
+        lua_insert(L, -2);
+        lua_rawset(L, 5);  /* replace value by its clone */
+      }
+      lua_pop(L, 1);  /* pop value */
+    }
+    lua_pop(L, 1);  /* pop clone */
+  }
+}
+
+
+static int tclone (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  if (!lua_toboolean(L, 2))
+    lua_clonetable(L, 1);
+  else {
+    lua_settop(L, 1);
+    lua_newtable(L);  /* map from tables to their clones */
+    lua_newtable(L);  /* queue of clones to fix */
+    lua_clonetable(L, 1);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 2);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 3, 1);
+    deepclone(L);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Quicksort
@@ -434,6 +530,10 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"reserve", treserve},
+  {"clear", tclear},
+  {"clone", tclone},
   {NULL, NULL}
 };
 
@@ -125,6 +125,14 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for functions called when the memory in use crosses a limit
+** (returns the limit to use from then on)
+*/
+typedef size_t (*lua_MemLimit) (void *ud, lua_State *L, int what,
+                                size_t total, size_t limit);
+
+
 
 /*
 ** generic extra include file
@@ -308,11 +316,83 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCSETMAJORINC	8
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETSTEPUS		12
+#define LUA_GCSTEPUS		13
+#define LUA_GCSETSTATS		14
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** memory limits (0 means no limit)
+*/
+
+#define LUA_MEMSOFT	0	/* above it, the collector works harder */
+#define LUA_MEMHARD	1	/* above it, allocations fail */
+
+LUA_API size_t (lua_setmemlimit) (lua_State *L, int what, size_t limit);
+LUA_API void (lua_setmemlimitf) (lua_State *L, lua_MemLimit f, void *ud);
+
+
+/*
+** Statistics of a collection cycle (enabled by LUA_GCSETSTATS); times
+** are in microseconds. Pause bucket 0 counts steps shorter than one
+** microsecond; bucket i counts those shorter than 2^i and not in a
+** lower bucket (the last one gets all longer steps).
+*/
+#define LUA_GCSTATPAUSES	16
+
+typedef struct lua_GCStats {
+  lua_Integer cycles;  /* number of cycles finished */
+  lua_Integer propagate, atomic, sweep, finalizers;  /* time per phase */
+  lua_Integer traversed;  /* objects traversed */
+  lua_Integer ephemeronpasses;  /* passes to converge ephemeron tables */
+  lua_Integer freed[LUA_NUMTAGS];  /* bytes freed, by basic type */
+  lua_Integer pauses[LUA_GCSTATPAUSES];  /* steps, by duration */
+} lua_GCStats;
+
+LUA_API int (lua_gcstats) (lua_State *L, lua_GCStats *s);
+
+
+/*
+** native-compiler function and options
+*/
+
+#define LUA_JITSTOP		0
+#define LUA_JITRESTART		1
+#define LUA_JITISRUNNING	2
+#define LUA_JITSETHOT		3
+
+LUA_API int (lua_jit) (lua_State *L, int what, int data);
+
+
+/*
+** compiler options (for chunks loaded afterwards)
+*/
+
+#define LUA_COPTHOIST	1	/* keep lookups of globals in loops in registers */
+#define LUA_COPTCONST	2	/* propagate constant locals, remove dead code */
+
+LUA_API int (lua_compileropts) (lua_State *L, int opts);
+
+
+/*
+** heap profiler (samples allocations by Lua call stack)
+*/
+
+#define LUA_PROFLIVE	0	/* sampled bytes still in use */
+#define LUA_PROFALLOC	1	/* sampled bytes allocated */
+#define LUA_PROFFREED	2	/* sampled bytes already freed */
+
+LUA_API int (lua_heapprofile) (lua_State *L, int rate);
+LUA_API int (lua_heapdump) (lua_State *L, int what, lua_Writer writer,
+                                                    void *data);
+
+
 /*
 ** miscellaneous functions
 */
@@ -320,6 +400,9 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API void  (lua_reservetable) (lua_State *L, int idx, int narr, int nrec);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+LUA_API void  (lua_clonetable) (lua_State *L, int idx);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
@@ -328,6 +411,7 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_setbulkfree) (lua_State *L, int on);
 
 
 
@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -35,6 +36,29 @@
 #define MAXTAGLOOP	2000
 
 
+/*
+** By default, use jump tables in the main interpreter loop on gcc
+** and compatible compilers.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+** Number of times an instruction may fall back from a quickened form
+** to its regular form before the interpreter stops quickening it.
+** (0 disables quickening.)
+*/
+#if !defined(LUAI_MAXDEOPT)
+#define LUAI_MAXDEOPT	4
+#endif
+
+
 
 /*
 ** 'l_intfitsf' checks whether a given integer can be converted to a
@@ -155,10 +179,12 @@ static int forlimit (const TValue *obj, lua_Integer *p, lua_Integer step,
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
-** t[k] entry (which must be nil).
+** t[k] entry (which must be nil). If 'hint' is not NULL, 'key' is a
+** short string and 'hint' is the inline cache of the instruction doing
+** the access, used for the tables along the '__index' chain.
 */
 void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
-                      const TValue *slot) {
+                      const TValue *slot, unsigned int *hint) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -183,7 +209,14 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
       return;
     }
     t = tm;  /* else try to access 'tm[key]' */
-    if (luaV_fastget(L,t,key,slot,luaH_get)) {  /* fast track? */
+    if (hint != NULL && ttistable(t)) {
+      slot = luaH_getcached(hvalue(t), tsvalue(key), hint);
+      if (!ttisnil(slot)) {
+        setobj2s(L, val, slot);  /* done */
+        return;
+      }
+    }
+    else if (luaV_fastget(L,t,key,slot,luaH_get)) {  /* fast track? */
       setobj2s(L, val, slot);  /* done */
       return;
     }
@@ -213,9 +246,9 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
         if (slot == luaO_nilobject)  /* no previous entry? */
           slot = luaH_newkey(L, h, key);  /* create one */
         /* no metamethod and (now) there is an entry with given key */
-        setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
+        luaH_setnewslot(L, h, slot, val);  /* set its new value */
         invalidateTMcache(h);
-        luaC_barrierback(L, h, val);
+        luaC_barrierslot(L, h, slot, val);
         return;
       }
       /* else will try the metamethod */
@@ -238,6 +271,67 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 }
 
 
+/*
+** Raw lookup of 'key' in table 't', following '__index' fields that
+** are tables. Return NULL if 't' is not a table or if the lookup
+** needs to call a metamethod.
+*/
+static const TValue *rawlookup (lua_State *L, const TValue *t,
+                                TString *key) {
+  int loop;  /* counter to avoid infinite loops */
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *slot, *tm;
+    if (!ttistable(t))
+      return NULL;
+    slot = luaH_getshortstr(hvalue(t), key);
+    if (!ttisnil(slot))
+      return slot;
+    tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);
+    if (tm == NULL)
+      return slot;  /* field is absent */
+    /* result now depends on '__index' fields, too */
+    G(L)->tmname[TM_INDEX]->extra |= WATCHEDKEY;
+    t = tm;
+  }
+  return NULL;
+}
+
+
+/*
+** Execute the OP_HOIST at 'pc' (see its description in lopcodes.h).
+** If the value in its hidden registers is from an old epoch, redo the
+** lookups that follow it, without metamethods, and mark their keys so
+** that assignments to them start a new epoch. (Only closed upvalues
+** are safe to use, as the others change with plain register moves.)
+** Return true if the result is in place and the lookups must be
+** skipped.
+*/
+int luaV_hoist (lua_State *L, LClosure *cl, StkId base,
+                const Instruction *pc) {
+  StkId rb = base + GETARG_B(*pc);
+  int n = GETARG_C(*pc);
+  if (!ttisinteger(rb + 1) || ivalue(rb + 1) != G(L)->hoistepoch) {
+    UpVal *uv = cl->upvals[GETARG_B(pc[1])];
+    const TValue *v = uv->v;
+    int j;
+    if (upisopen(uv))  /* its function may assign it (without notice)? */
+      return 0;
+    for (j = 1; j <= n; j++) {
+      const TValue *k = cl->p->k + INDEXK(GETARG_C(pc[j]));
+      lua_assert(ISK(GETARG_C(pc[j])));
+      if (!ttisshrstring(k) || isreserved(tsvalue(k)) ||
+          (v = rawlookup(L, v, tsvalue(k))) == NULL)
+        return 0;  /* let the lookups run */
+      tsvalue(k)->extra |= WATCHEDKEY;
+    }
+    setobj2s(L, rb, v);
+    setivalue(rb + 1, G(L)->hoistepoch);
+  }
+  setobjs2s(L, base + GETARG_A(pc[n]), rb);
+  return 1;
+}
+
+
 /*
 ** Compare two strings 'ls' x 'rs', returning an integer smaller-equal-
 ** -larger than zero if 'ls' is smaller-equal-larger than 'rs'.
@@ -657,7 +751,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -734,11 +828,27 @@ void luaV_finishOp (lua_State *L) {
 	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
 
 
+/*
+** Every function entry and backward jump counts toward compiling the
+** function to native code (see ljit.c); once it is compiled, these
+** are the points where execution moves to native code.
+*/
+#if LUAJ_NATIVE
+#define jitpoint(L,ci,cl)  { Proto *jp = (cl)->p; \
+  if (jp->jit == NULL) { \
+    if (--jp->jitcount == 0) luaJ_compile(L, jp); } \
+  else if (luaJ_worth(L, ci, jp)) luaJ_execute(L, ci); }
+#else
+#define jitpoint(L,ci,cl)	((void)0)
+#endif
+
+
 /* execute a jump instruction */
 #define dojump(ci,i,e) \
   { int a = GETARG_A(i); \
     if (a != 0) luaF_close(L, ci->u.l.base + a - 1); \
-    ci->u.l.savedpc += GETARG_sBx(i) + e; }
+    ci->u.l.savedpc += GETARG_sBx(i) + e; \
+    if (GETARG_sBx(i) < 0) jitpoint(L, ci, cl); }
 
 /* for test instructions, execute the jump instruction that follows it */
 #define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); }
@@ -752,9 +862,44 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** In a profiling build (LUAI_OPPAIRSTATS), count how many times each
+** pair of opcodes runs in sequence, the second falling through from
+** the first. 'luaV_printpairs' prints the counts when the state is
+** closed; they show which pairs are worth fusing (see 'luaK_fuse').
+*/
+#if defined(LUAI_OPPAIRSTATS)
+
+#define countpair(L,pc,i)  { global_State *g_ = G(L); \
+  OpCode op_ = GET_BASEOPCODE(i); \
+  if ((pc) == g_->oplastpc + 1) g_->oppairs[g_->oplast][op_]++; \
+  g_->oplastpc = (pc); g_->oplast = cast_byte(op_); }
+
+
+void luaV_printpairs (lua_State *L) {
+  global_State *g = G(L);
+  int a, b;
+  for (a = 0; a < NUM_OPCODES; a++) {
+    for (b = 0; b < NUM_OPCODES; b++) {
+      if (g->oppairs[a][b] != 0)
+        fprintf(stderr, "%-10s %-10s %lu\n", luaP_opnames[a], luaP_opnames[b],
+                        cast(unsigned long, g->oppairs[a][b]));
+    }
+  }
+  fflush(stderr);
+}
+
+#else
+
+#define countpair(L,pc,i)	((void)0)
+
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
+  countpair(L, ci->u.l.savedpc - 1, i); \
   if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
     Protect(luaG_traceexec(L)); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
@@ -773,27 +918,226 @@ void luaV_finishOp (lua_State *L) {
 */
 #define gettableProtected(L,t,k,v)  { const TValue *slot; \
   if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
-  else Protect(luaV_finishget(L,t,k,v,slot)); }
+  else Protect(luaV_finishget(L,t,k,v,slot,NULL)); }
 
 
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
+  luaV_checkwatch(L,k); \
   if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/* inline cache of the instruction being executed */
+#define icache(ci,cl)	((cl)->p->icache + pcRel((ci)->u.l.savedpc, (cl)->p))
+
+
+/*
+** Versions of 'gettableProtected' and 'settableProtected' for constant
+** short string keys (field accesses), which look up the key through the
+** inline cache 'h' of the current instruction. Keys in registers usually
+** change at each execution and do not use the cache: each access would
+** wait for the previous one to update the hint, so that loops such as
+** 't[keys[i]]' could no longer overlap their cache misses.
+*/
+#define getfieldProtected(L,t,k,v,h) { const TValue *slot = NULL; \
+  if (ttistable(t) && \
+      !ttisnil(slot = luaH_getcached(hvalue(t), tsvalue(k), h))) \
+    { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot,h)); }
+
+
+#define setfieldProtected(L,t,k,v,h) { const TValue *slot = NULL; \
+  luaV_checkwatch(L,k); \
+  if (ttistable(t) && \
+      !ttisnil(slot = luaH_getcached(hvalue(t), tsvalue(k), h))) { \
+    luaC_barrierslot(L, hvalue(t), slot, v); \
+    setobj2t(L, cast(TValue *, slot), v); } \
+  else Protect(luaV_finishset(L,t,k,v,slot)); }
+
+
+/*
+** Whether 't[k]' is a non-nil element of a packed array part. Such an
+** element is copied straight into its register: going through the copy
+** in the array's 'slot' (see 'luaH_getint') adds a store and a reload
+** that make the next lookup wait, which doubles the cost of loops such
+** as 't[keys[i]]' when 't' does not fit in the cache.
+*/
+#define inpacked(t,k)  \
+	(ttisinteger(k) && ttistable(t) && ispacked(hvalue(t)) && \
+	 l_castS2U(ivalue(k)) - 1 < gpacked(hvalue(t))->n)
+
+
+/*
+** Whether 't[k] = v' can go straight into the packed array part of 't':
+** 'v' has the type of its elements, and 't[k]' is one of them or the
+** one after the last (and then there is no '__newindex' to try, as 't'
+** has no metatable). Appends that fill presized array parts take this
+** path, too.
+*/
+#define topacked(t,k,v)  \
+	(ttisinteger(k) && ttistable(t) && ispacked(hvalue(t)) && \
+	 ttype(v) == hvalue(t)->atype && \
+	 (l_castS2U(ivalue(k)) - 1 < gpacked(hvalue(t))->n || \
+	  (l_castS2U(ivalue(k)) - 1 == gpacked(hvalue(t))->n && \
+	   gpacked(hvalue(t))->n < hvalue(t)->sizearray && \
+	   hvalue(t)->metatable == NULL)))
+
+
+/* bodies of OP_GETTABUP/OP_GETTABLE and OP_SETTABUP/OP_SETTABLE */
+#define op_gettable(L,t) { \
+  TValue *rt = (t); \
+  TValue *rc = RKC(i); \
+  if (ISK(GETARG_C(i)) && ttisshrstring(rc)) \
+    getfieldProtected(L, rt, rc, ra, icache(ci, cl)) \
+  else if (inpacked(rt, rc)) { \
+    Table *h = hvalue(rt); \
+    val_(ra) = gpacked(h)->v[ivalue(rc) - 1]; \
+    settt_(ra, h->atype); } \
+  else \
+    gettableProtected(L, rt, rc, ra); }
+
+#define op_settable(L,t) { \
+  TValue *rt = (t); \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (ISK(GETARG_B(i)) && ttisshrstring(rb)) \
+    setfieldProtected(L, rt, rb, rc, icache(ci, cl)) \
+  else if (topacked(rt, rb, rc)) { \
+    PackedArray *p = gpacked(hvalue(rt)); \
+    unsigned int e = cast(unsigned int, ivalue(rb) - 1); \
+    p->v[e] = val_(rc); \
+    if (e == p->n) p->n++; } \
+  else \
+    settableProtected(L, rt, rb, rc); }
+
+
+/* body of OP_SELF */
+#define op_self(L) { \
+  const TValue *aux; \
+  StkId rb = RB(i); \
+  TValue *rc = RKC(i); \
+  TString *key = tsvalue(rc);  /* key must be a string */ \
+  setobjs2s(L, ra + 1, rb); \
+  if (key->tt == LUA_TSHRSTR) \
+    getfieldProtected(L, rb, rc, ra, icache(ci, cl)) \
+  else if (luaV_fastget(L, rb, key, aux, luaH_getstr)) { \
+    setobj2s(L, ra, aux); \
+  } \
+  else Protect(luaV_finishget(L, rb, rc, ra, aux, NULL)); }
+
+
+/*
+** Quickening. Arithmetic and order instructions that see operands of
+** a stable type are rewritten in place into a specialized opcode
+** (see lopcodes.h). A specialized instruction whose guard fails is
+** rewritten back to its regular form and the fall back is counted in
+** its (otherwise unused) inline-cache slot, so that instructions with
+** polymorphic operands eventually stay generic.
+*/
+#define curinst(ci,cl)	((cl)->p->code + pcRel((ci)->u.l.savedpc, (cl)->p))
+
+#define quicken(ci,cl,o)  \
+	{ if (*icache(ci,cl) < LUAI_MAXDEOPT) SET_OPCODE(*curinst(ci,cl), o); }
+
+#define noquicken(ci,cl,o)	{ }
+
+#define dequicken(ci,cl)  { Instruction *pi_ = curinst(ci,cl); \
+  SET_OPCODE(*pi_, GET_BASEOPCODE(*pi_)); (*icache(ci,cl))++; }
+
+
+/*
+** regular body of OP_ADD, OP_SUB, and OP_MUL; 'q' is 'quicken' or
+** 'noquicken' (for superinstructions, which are not quickened)
+*/
+#define op_arith(L,iop,fop,tm,q,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  lua_Number nb; lua_Number nc; \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc); \
+    q(ci, cl, qi); \
+    setivalue(ra, intop(iop, ib, ic)); \
+  } \
+  else if (tonumber(rb, &nb) && tonumber(rc, &nc)) { \
+    if (ttisfloat(rb) && ttisfloat(rc)) q(ci, cl, qf); \
+    setfltvalue(ra, fop(L, nb, nc)); \
+  } \
+  else { Protect(luaT_trybinTM(L, rb, rc, ra, tm)); } }
+
+
+/* bodies of OP_ADDINT, OP_SUBINT, and OP_MULINT */
+#define op_arithint(L,iop,fop,tm,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    setivalue(ra, intop(iop, ivalue(rb), ivalue(rc))); \
+  } \
+  else { dequicken(ci, cl); op_arith(L, iop, fop, tm, quicken, qi, qf); } }
+
+
+/* bodies of OP_ADDFLT, OP_SUBFLT, and OP_MULFLT */
+#define op_arithflt(L,iop,fop,tm,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (ttisfloat(rb) && ttisfloat(rc)) { \
+    setfltvalue(ra, fop(L, fltvalue(rb), fltvalue(rc))); \
+  } \
+  else { dequicken(ci, cl); op_arith(L, iop, fop, tm, quicken, qi, qf); } }
+
+
+/* regular body of OP_LT and OP_LE */
+#define op_order(L,cmp,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (ttisinteger(rb) && ttisinteger(rc)) quicken(ci, cl, qi) \
+  else if (ttisfloat(rb) && ttisfloat(rc)) quicken(ci, cl, qf) \
+  Protect( \
+    if (cmp(L, rb, rc) != GETARG_A(i)) \
+      ci->u.l.savedpc++; \
+    else \
+      donextjump(ci); \
+  ) }
+
+
+/*
+** bodies of OP_LTINT, OP_LTFLT, etc.: 'chk' checks the operand type,
+** 'get' reads its value, and 'op' compares them
+*/
+#define op_orderq(L,chk,get,op,cmp,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (chk(rb) && chk(rc)) { \
+    if (op(get(rb), get(rc)) != GETARG_A(i)) \
+      ci->u.l.savedpc++; \
+    else \
+      donextjump(ci); \
+  } \
+  else { dequicken(ci, cl); op_order(L, cmp, qi, qf); } }
+
+#define l_intlt(a,b)	((a) < (b))
+#define l_intle(a,b)	((a) <= (b))
+#define l_fltlt(a,b)	luai_numlt(a,b)
+#define l_fltle(a,b)	luai_numle(a,b)
+
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  if (ci->u.l.savedpc == cl->p->code)  /* function entry? */
+    jitpoint(L, ci, cl);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -834,40 +1178,34 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        TValue *upval = cl->upvals[GETARG_B(i)]->v;
-        TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        op_gettable(L, cl->upvals[GETARG_B(i)]->v);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
-        StkId rb = RB(i);
-        TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+       l_gettable:
+        op_gettable(L, RB(i));
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
-        TValue *upval = cl->upvals[GETARG_A(i)]->v;
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        settableProtected(L, upval, rb, rc);
+        op_settable(L, cl->upvals[GETARG_A(i)]->v);
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
+        if (ttistable(uv->v))  /* may hold tables of hoisted lookups */
+          G(L)->hoistepoch++;
         setobj(L, uv->v, ra);
         luaC_upvalbarrier(L, uv);
         vmbreak;
       }
       vmcase(OP_SETTABLE) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        settableProtected(L, ra, rb, rc);
+        op_settable(L, ra);
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
-        Table *t = luaH_new(L);
+        Table *t = luaH_newsized(L, luaO_fb2int(c));
         sethvalue(L, ra, t);
         if (b != 0 || c != 0)
           luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
@@ -875,57 +1213,44 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_SELF) {
-        const TValue *aux;
-        StkId rb = RB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
-          setobj2s(L, ra, aux);
-        }
-        else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        op_self(L);
         vmbreak;
       }
       vmcase(OP_ADD) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(+, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numadd(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+       l_add:
+        op_arith(L, +, luai_numadd, TM_ADD, quicken, OP_ADDINT, OP_ADDFLT);
+        vmbreak;
+      }
+      vmcase(OP_ADDINT) {
+        op_arithint(L, +, luai_numadd, TM_ADD, OP_ADDINT, OP_ADDFLT);
+        vmbreak;
+      }
+      vmcase(OP_ADDFLT) {
+        op_arithflt(L, +, luai_numadd, TM_ADD, OP_ADDINT, OP_ADDFLT);
         vmbreak;
       }
       vmcase(OP_SUB) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(-, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numsub(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB)); }
+        op_arith(L, -, luai_numsub, TM_SUB, quicken, OP_SUBINT, OP_SUBFLT);
+        vmbreak;
+      }
+      vmcase(OP_SUBINT) {
+        op_arithint(L, -, luai_numsub, TM_SUB, OP_SUBINT, OP_SUBFLT);
+        vmbreak;
+      }
+      vmcase(OP_SUBFLT) {
+        op_arithflt(L, -, luai_numsub, TM_SUB, OP_SUBINT, OP_SUBFLT);
         vmbreak;
       }
       vmcase(OP_MUL) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(*, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_nummul(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_MUL)); }
+        op_arith(L, *, luai_nummul, TM_MUL, quicken, OP_MULINT, OP_MULFLT);
+        vmbreak;
+      }
+      vmcase(OP_MULINT) {
+        op_arithint(L, *, luai_nummul, TM_MUL, OP_MULINT, OP_MULFLT);
+        vmbreak;
+      }
+      vmcase(OP_MULFLT) {
+        op_arithflt(L, *, luai_nummul, TM_MUL, OP_MULINT, OP_MULFLT);
         vmbreak;
       }
       vmcase(OP_DIV) {  /* float division (always with floats) */
@@ -1093,21 +1418,31 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_LT) {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        op_order(L, luaV_lessthan, OP_LTINT, OP_LTFLT);
+        vmbreak;
+      }
+      vmcase(OP_LTINT) {
+        op_orderq(L, ttisinteger, ivalue, l_intlt, luaV_lessthan,
+                  OP_LTINT, OP_LTFLT);
+        vmbreak;
+      }
+      vmcase(OP_LTFLT) {
+        op_orderq(L, ttisfloat, fltvalue, l_fltlt, luaV_lessthan,
+                  OP_LTINT, OP_LTFLT);
         vmbreak;
       }
       vmcase(OP_LE) {
-        Protect(
-          if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        op_order(L, luaV_lessequal, OP_LEINT, OP_LEFLT);
+        vmbreak;
+      }
+      vmcase(OP_LEINT) {
+        op_orderq(L, ttisinteger, ivalue, l_intle, luaV_lessequal,
+                  OP_LEINT, OP_LEFLT);
+        vmbreak;
+      }
+      vmcase(OP_LEFLT) {
+        op_orderq(L, ttisfloat, fltvalue, l_fltle, luaV_lessequal,
+                  OP_LEINT, OP_LEFLT);
         vmbreak;
       }
       vmcase(OP_TEST) {
@@ -1128,8 +1463,11 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CALL) {
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
+        int b;
+        int nresults;
+       l_call:
+        b = GETARG_B(i);
+        nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         if (luaD_precall(L, ra, nresults)) {  /* C function? */
           if (nresults >= 0)
@@ -1188,6 +1526,7 @@ void luaV_execute (lua_State *L) {
         }
       }
       vmcase(OP_FORLOOP) {
+       l_forloop:
         if (ttisinteger(ra)) {  /* integer loop? */
           lua_Integer step = ivalue(ra + 2);
           lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */
@@ -1196,6 +1535,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            jitpoint(L, ci, cl);
           }
         }
         else {  /* floating loop */
@@ -1207,6 +1547,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            jitpoint(L, ci, cl);
           }
         }
         vmbreak;
@@ -1257,6 +1598,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+          jitpoint(L, ci, cl);
         }
         vmbreak;
       }
@@ -1274,11 +1616,7 @@ void luaV_execute (lua_State *L) {
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
         if (last > h->sizearray)  /* needs more space? */
           luaH_resizearray(L, h, last);  /* preallocate it at once */
-        for (; n > 0; n--) {
-          TValue *val = ra+n;
-          luaH_setint(L, h, last--, val);
-          luaC_barrierback(L, h, val);
-        }
+        luaH_setlist(L, h, last - n, ra + 1, n);
         L->top = ci->top;  /* correct top (in case of previous open call) */
         vmbreak;
       }
@@ -1314,6 +1652,48 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_HOIST) {
+        StkId rb = RB(i);
+        const Instruction *next = ci->u.l.savedpc;
+        if (ttisinteger(rb + 1) && ivalue(rb + 1) == G(L)->hoistepoch) {
+          int n = GETARG_C(i);
+          setobjs2s(L, base + GETARG_A(next[n - 1]), rb);
+          ci->u.l.savedpc += n;
+        }
+        else if (luaV_hoist(L, cl, base, next - 1))
+          ci->u.l.savedpc += GETARG_C(i);
+        vmbreak;
+      }
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfetch();
+        goto l_call;
+      }
+      vmcase(OP_GETTABUPTAB) {
+        op_gettable(L, cl->upvals[GETARG_B(i)]->v);
+        vmfetch();
+        goto l_gettable;
+      }
+      vmcase(OP_GETTABADD) {
+        op_gettable(L, RB(i));
+        vmfetch();
+        goto l_add;
+      }
+      vmcase(OP_MULADD) {
+        op_arith(L, *, luai_nummul, TM_MUL, noquicken, 0, 0);
+        vmfetch();
+        goto l_add;
+      }
+      vmcase(OP_ADDFORLOOP) {
+        op_arith(L, +, luai_numadd, TM_ADD, noquicken, 0, 0);
+        vmfetch();
+        goto l_forloop;
+      }
+      vmcase(OP_SETTABFORLOOP) {
+        op_settable(L, ra);
+        vmfetch();
+        goto l_forloop;
+      }
     }
   }
 }
@@ -66,7 +66,7 @@
 */
 #define luaV_gettable(L,t,k,v) { const TValue *slot; \
   if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
-  else luaV_finishget(L,t,k,v,slot); }
+  else luaV_finishget(L,t,k,v,slot,NULL); }
 
 
 /*
@@ -82,16 +82,26 @@
    ? (slot = NULL, 0) \
    : (slot = f(hvalue(t), k), \
      ttisnil(slot) ? 0 \
-     : (luaC_barrierback(L, hvalue(t), v), \
-        setobj2t(L, cast(TValue *,slot), v), \
+     : (luaC_barrierslot(L, hvalue(t), slot, v), \
+        luaH_setslot(L, hvalue(t), slot, v), \
         1)))
 
 
 #define luaV_settable(L,t,k,v) { const TValue *slot; \
+  luaV_checkwatch(L,k); \
   if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
     luaV_finishset(L,t,k,v,slot); }
 
 
+/*
+** Start a new hoisting epoch if key 'k' is used by hoisted lookups
+** (see 'luaV_hoist'). Every assignment 't[k] = v' that may change a
+** field with a string key must do that before the change.
+*/
+#define luaV_checkwatch(L,k) \
+  { if (ttisstring(k) && iswatched(tsvalue(k))) G(L)->hoistepoch++; }
+
+
 
 LUAI_FUNC int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r);
@@ -99,9 +109,12 @@ LUAI_FUNC int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_tonumber_ (const TValue *obj, lua_Number *n);
 LUAI_FUNC int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode);
 LUAI_FUNC void luaV_finishget (lua_State *L, const TValue *t, TValue *key,
-                               StkId val, const TValue *slot);
+                               StkId val, const TValue *slot,
+                               unsigned int *hint);
 LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                                StkId val, const TValue *slot);
+LUAI_FUNC int luaV_hoist (lua_State *L, LClosure *cl, StkId base,
+                          const Instruction *pc);
 LUAI_FUNC void luaV_finishOp (lua_State *L);
 LUAI_FUNC void luaV_execute (lua_State *L);
 LUAI_FUNC void luaV_concat (lua_State *L, int total);
@@ -109,5 +122,8 @@ LUAI_FUNC lua_Integer luaV_div (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
+#if defined(LUAI_OPPAIRSTATS)
+LUAI_FUNC void luaV_printpairs (lua_State *L);
+#endif
 
 #endif
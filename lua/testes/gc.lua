@@ -0,0 +1,248 @@
+-- $Id: gc.lua $
+-- Tests for the collector extensions (run with 'lua gc.lua')
+
+print "testing generational mode"
+
+local function gcinfo ()
+  return collectgarbage("count") * 1024
+end
+
+
+-- switching modes returns the previous mode
+do
+  assert(collectgarbage("incremental") == "incremental")
+  assert(collectgarbage("generational") == "incremental")
+  assert(collectgarbage("generational") == "generational")
+  assert(collectgarbage("generational", 30) == "generational")
+  assert(collectgarbage("incremental") == "generational")
+  assert(collectgarbage("incremental") == "incremental")
+  -- in the middle of an incremental cycle
+  local t = {}
+  for i = 1, 10000 do t[i] = {} end
+  collectgarbage("step", 1)
+  assert(collectgarbage("generational") == "incremental")
+  for i = 1, 10000 do assert(type(t[i]) == "table") end
+  assert(collectgarbage("incremental") == "generational")
+  for i = 1, 10000 do assert(type(t[i]) == "table") end
+end
+
+
+-- run 'f' in both modes
+local function bothmodes (f)
+  local old = collectgarbage("incremental")
+  f("incremental")
+  collectgarbage("generational")
+  f("generational")
+  collectgarbage(old)
+end
+
+
+-- young objects stored in old ones survive young collections
+bothmodes(function (mode)
+  local old = {}
+  collectgarbage(); collectgarbage()  -- 'old' is old now
+  for i = 1, 100000 do
+    old[i] = {i}
+    if i % 1000 == 0 then collectgarbage("step") end
+  end
+  local u = setmetatable({}, {__index = old})  -- new table, old metatable
+  collectgarbage("step")
+  for i = 1, 100000 do assert(old[i][1] == i and u[i][1] == i) end
+  -- old closures with new upvalues
+  local f
+  do local x = {}; f = function () return x end end
+  collectgarbage(); collectgarbage()
+  for i = 1, 100 do
+    local y = {i}
+    debug.setupvalue(f, 1, y)
+    collectgarbage("step")
+    assert(f()[1] == i)
+  end
+end)
+
+
+-- garbage goes away without full collections
+bothmodes(function (mode)
+  collectgarbage()
+  local base = gcinfo()
+  for i = 1, 2000000 do local _ = {i} end
+  assert(gcinfo() < base + 10 * 1024 * 1024, mode)
+end)
+
+
+-- weak tables and finalizers
+bothmodes(function (mode)
+  local keep = {}
+  local wk = setmetatable({}, {__mode = "k"})
+  local wv = setmetatable({}, {__mode = "v"})
+  collectgarbage(); collectgarbage()  -- weak tables are old now
+  for i = 1, 100 do
+    local o = {}
+    wk[o] = i; wv[i] = o
+    if i % 2 == 0 then keep[#keep + 1] = o end
+  end
+  collectgarbage(); collectgarbage()
+  local nk = 0
+  for k, v in pairs(wk) do nk = nk + 1; assert(v % 2 == 0) end
+  assert(nk == 50)
+  for i = 1, 100 do assert((wv[i] == nil) == (i % 2 == 1)) end
+  -- finalizers run once, and may resurrect their objects
+  local ran = 0
+  local saved
+  for i = 1, 100 do
+    setmetatable({}, {__gc = function (o) ran = ran + 1; saved = o end})
+  end
+  collectgarbage(); collectgarbage()
+  assert(ran == 100 and saved)
+  saved = nil
+  collectgarbage(); collectgarbage()
+  assert(ran == 100, mode)
+end)
+
+assert(collectgarbage("isrunning"))
+
+
+print "testing timed steps"
+
+-- the time target of steps; 0 (no target) by default
+do
+  assert(collectgarbage("setstepus", 100) == 0)
+  assert(collectgarbage("setstepus", 200) == 100)
+  assert(collectgarbage("setstepus", -1) == 200)  -- negative is 0
+  assert(collectgarbage("setstepus", 0) == 0)
+end
+
+
+-- "stepus" runs the collector for some time and tells whether a cycle
+-- finished; repeated, it finishes cycles
+bothmodes(function (mode)
+  local keep = {}
+  for i = 1, 10000 do keep[i] = {i} end
+  local wv = setmetatable({}, {__mode = "v"})
+  collectgarbage(); collectgarbage()
+  collectgarbage("stop")  -- (so that the garbage stays young)
+  for i = 1, 10000 do wv[i] = {} end  -- garbage
+  local cycles = 0
+  for i = 1, 100000 do
+    local done = collectgarbage("stepus", 10)
+    assert(type(done) == "boolean")
+    if done then
+      cycles = cycles + 1
+      if cycles == 2 then break end
+    end
+  end
+  collectgarbage("restart")
+  assert(cycles == 2, mode)
+  assert(next(wv) == nil, mode)
+  for i = 1, 10000 do assert(keep[i][1] == i) end
+end)
+
+
+-- with a time target, allocation-driven steps still keep up
+bothmodes(function (mode)
+  local old = collectgarbage("setstepus", 50)
+  collectgarbage()
+  local base = gcinfo()
+  local keep = {}
+  for i = 1, 2000000 do
+    local t = {i}
+    if i % 100 == 0 then keep[#keep + 1] = t end
+  end
+  assert(gcinfo() < base + 20 * 1024 * 1024, mode)
+  for i = 1, #keep do assert(keep[i][1] == i * 100) end
+  collectgarbage("setstepus", old)
+end)
+
+
+print "testing collector statistics"
+
+-- statistics are off by default
+do
+  assert(collectgarbage("stats") == nil)
+  assert(collectgarbage("setstats", 1) == false)
+  assert(collectgarbage("setstats", 1) == true)
+  assert(collectgarbage("setstats", 0) == true)
+  assert(collectgarbage("stats") == nil)
+  assert(collectgarbage("setstats", 0) == false)
+end
+
+
+-- "stats" describes the last finished cycle
+bothmodes(function (mode)
+  collectgarbage("setstats", 1)
+  local keep = {}
+  for i = 1, 1000 do keep[i] = {} end
+  local ek = setmetatable({}, {__mode = "k"})  -- an ephemeron chain
+  local k = keep[1]
+  for i = 2, 100 do ek[k] = keep[i]; k = keep[i] end
+  collectgarbage(); collectgarbage()
+  collectgarbage("stop")  -- (so that the next cycle frees all garbage)
+  for i = 1, 10000 do local _ = {}; _ = "s" .. i end  -- garbage
+  collectgarbage(); collectgarbage()
+  collectgarbage("restart")
+  local s = collectgarbage("stats")
+  for _, f in ipairs{"cycles", "propagate", "atomic", "sweep", "finalizers",
+                     "traversed", "ephemeronpasses"} do
+    assert(math.type(s[f]) == "integer" and s[f] >= 0, f)
+  end
+  assert(s.cycles >= 3 and s.traversed >= 1000, mode)
+  assert(s.ephemeronpasses > 0, mode)
+  assert(s.freed.table > 10000 * 16 and s.freed.string > 0, mode)
+  assert(#s.pauses == 16)
+  local steps = 0
+  for i = 1, #s.pauses do steps = steps + s.pauses[i] end
+  assert(steps > 0, mode)
+  -- the count of cycles goes on
+  collectgarbage()
+  assert(collectgarbage("stats").cycles > s.cycles, mode)
+  assert(collectgarbage("setstats", 0) == true)
+  assert(collectgarbage("stats") == nil)
+end)
+
+
+print "testing finalizers set late"
+
+-- objects that get a finalizer long after their creation
+bothmodes(function (mode)
+  local N = 10000
+  local cnt = 0
+  local mt = {__gc = function (o) cnt = cnt + 1; assert(o.x) end}
+  local t = {}
+  for i = 1, N do t[i] = {x = i} end
+  for i = 1, N do setmetatable(t[i], mt) end
+  for i = 1, N, 2 do t[i] = nil end  -- die before a sweep moves them
+  collectgarbage(); collectgarbage()
+  assert(cnt == N // 2, mode)
+  t = nil
+  collectgarbage(); collectgarbage()
+  assert(cnt == N, mode)
+  -- one full collection runs the finalizers of dead objects
+  cnt = 0
+  t = {}
+  for i = 1, N do t[i] = {x = i} end
+  for i = 1, 100 do local _ = {} end  -- ('t' is not among the last objects)
+  for i = 1, N do setmetatable(t[i], mt) end
+  t = nil
+  collectgarbage()
+  assert(cnt == N, mode)
+  -- with steps instead of full collections
+  cnt = 0
+  t = {}
+  for i = 1, N do t[i] = {x = i} end
+  for i = 1, N do setmetatable(t[i], mt) end
+  t = nil
+  for i = 1, 200000 do local _ = {i} end
+  collectgarbage(); collectgarbage()
+  assert(cnt == N, mode)
+  -- resurrected, and a key in a weak table
+  local weak = setmetatable({}, {__mode = "k"})
+  local saved
+  local obj = {x = 1}
+  for i = 1, 100 do local _ = {} end
+  setmetatable(obj, {__gc = function (o) saved = o end})
+  weak[obj] = true; obj = nil
+  collectgarbage(); collectgarbage()
+  assert(saved and saved.x == 1 and weak[saved], mode)  -- (still alive)
+end)
+
+print "OK"
@@ -0,0 +1,87 @@
+-- $Id: heapdump.lua $
+-- Tests for the heap profiler (run with 'lua heapdump.lua')
+
+print "testing debug.heapprofile and debug.heapdump"
+
+-- bytes of each site (folded stack) in a dump
+local function parse (dump)
+  local sites = {}
+  for line in string.gmatch(dump, "[^\n]+") do
+    local stack, bytes = string.match(line, "^(.+) (%d+)$")
+    assert(stack, line)
+    assert(not sites[stack])  -- one line per site
+    sites[stack] = tonumber(bytes)
+  end
+  return sites
+end
+
+-- bytes of the sites whose stack includes 'frame'
+local function bytesat (sites, frame)
+  local n = 0
+  for stack, bytes in pairs(sites) do
+    if string.find(stack, frame, 1, true) then n = n + bytes end
+  end
+  return n
+end
+
+
+-- the profiler is off by default
+assert(debug.heapdump() == nil)
+assert(debug.heapprofile() == 0)
+assert(debug.heapprofile(0) == 0)
+assert(not pcall(debug.heapprofile, -2))
+assert(not pcall(debug.heapdump, "none"))
+
+
+local RATE = 1024
+local N = 100000
+local SIZE = 30  -- elements in each table
+local line   -- line of the allocations in 'alloc'
+
+local function alloc (t)
+  line = debug.getinfo(1, "l").currentline + 1
+  for i = 1, N do t[i] = table.new(SIZE, 0) end
+end
+
+
+assert(debug.heapprofile(RATE) == 0)
+assert(debug.heapprofile(RATE) == RATE)  -- retuning keeps the data
+local t = {}
+local before = collectgarbage("count") * 1024
+alloc(t); local mainline = debug.getinfo(1, "l").currentline
+collectgarbage()  -- free the old array parts of 't'
+local used = collectgarbage("count") * 1024 - before
+local frame = string.format("heapdump.lua:%d", line)
+
+do  -- the live bytes of the site estimate the memory it allocated
+  local live = bytesat(parse(debug.heapdump("live")), frame)
+  assert(used / 2 < live and live < used * 2, live)
+  local alloc = bytesat(parse(debug.heapdump("alloc")), frame)
+  assert(alloc >= live)
+  assert(bytesat(parse(debug.heapdump("freed")), frame) < used / 10)
+  -- the default is "live"
+  assert(bytesat(parse(debug.heapdump()), frame) == live)
+  -- stacks go from the outermost frame to the innermost one ('table.new')
+  local tail = string.format("heapdump.lua:%d;%s;[C]", mainline, frame)
+  local found = false
+  for stack in pairs(parse(debug.heapdump("alloc"))) do
+    if string.sub(stack, -#tail) == tail then found = true end
+  end
+  assert(found)
+end
+
+do  -- freed blocks move from "live" to "freed"
+  local alloc = bytesat(parse(debug.heapdump("alloc")), frame)
+  t = nil
+  collectgarbage(); collectgarbage()
+  assert(bytesat(parse(debug.heapdump("live")), frame) < used / 10)
+  assert(bytesat(parse(debug.heapdump("freed")), frame) > used / 2)
+  assert(bytesat(parse(debug.heapdump("alloc")), frame) == alloc)
+end
+
+-- stopping discards the data
+assert(debug.heapprofile(0) == RATE)
+assert(debug.heapdump() == nil and debug.heapdump("alloc") == nil)
+assert(debug.heapprofile() == 0)
+
+print "OK"
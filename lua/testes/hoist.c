@@ -0,0 +1,71 @@
+/*
+** $Id: hoist.c $
+** Runs hoist.lua and optimize.lua with each combination of compiler
+** options and checks that all runs of each script give the same results
+** See Copyright Notice in lua.h
+**
+** Build it with the Lua library, e.g., from this directory,
+**   cc -O2 -I.. -o hoist hoist.c ../l*.c -lm
+** and run it (from this directory) with no arguments; it prints "OK"
+** when all runs agree.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static const int options[] = {
+  0, LUA_COPTHOIST, LUA_COPTCONST, LUA_COPTHOIST | LUA_COPTCONST
+};
+
+#define NOPTIONS	(sizeof(options) / sizeof(options[0]))
+
+
+static const char *const scripts[] = {"hoist.lua", "optimize.lua"};
+
+#define NSCRIPTS	(sizeof(scripts) / sizeof(scripts[0]))
+
+
+/* run 'script' compiled with 'opts'; push its result */
+static int run (lua_State *L, const char *script, int opts) {
+  lua_compileropts(L, opts);
+  if (luaL_loadfile(L, script) != LUA_OK ||
+      lua_pcall(L, 0, 1, 0) != LUA_OK) {
+    fprintf(stderr, "%s, options %d: %s\n", script, opts,
+                    lua_tostring(L, -1));
+    return 0;
+  }
+  if (!lua_isstring(L, -1)) {
+    fprintf(stderr, "%s, options %d: no results\n", script, opts);
+    return 0;
+  }
+  return 1;
+}
+
+
+int main (void) {
+  size_t i, s;
+  int status = 0;
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  for (s = 0; s < NSCRIPTS; s++) {
+    for (i = 0; i < NOPTIONS; i++) {
+      if (!run(L, scripts[s], options[i]))
+        return 1;
+      if (i > 0 && strcmp(lua_tostring(L, -1), lua_tostring(L, 1)) != 0) {
+        fprintf(stderr, "%s, options %d: results differ from options %d\n",
+                        scripts[s], options[i], options[0]);
+        status = 1;
+      }
+    }
+    lua_settop(L, 0);
+  }
+  lua_close(L);
+  if (status == 0)
+    printf("OK\n");
+  return status;
+}
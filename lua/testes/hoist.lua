@@ -0,0 +1,268 @@
+-- $Id: hoist.lua $
+-- Tests for the hoisting of lookups out of loops (LUA_COPTHOIST). Run
+-- it with 'lua hoist.lua' under any compiler options, or with 'hoist'
+-- (see hoist.c), which runs it with and without hoisting and compares
+-- the results.
+
+print "testing hoisted lookups"
+
+local log = {}
+
+-- records a result (which must be the same under all options)
+local function out (...)
+  local t = table.pack(...)
+  for i = 1, t.n do t[i] = tostring(t[i]) end
+  log[#log + 1] = table.concat(t, " ")
+end
+
+local function typenames (x)
+  return type(x) == "table" and "table" or tostring(x)
+end
+
+
+-- named locals between lookups keep their values
+do
+  local r = {}
+  for i = 1, 3 do
+    local m = string
+    local u = m.upper
+    r[#r + 1] = type(m) .. u("x")
+  end
+  local n = 0
+  while n < 3 do
+    local m = string
+    local f = m.format
+    r[#r + 1] = type(m) .. f("%d", n)
+    n = n + 1
+  end
+  repeat
+    local m = math
+    local p = m.pi
+    r[#r + 1] = typenames(m) .. math.type(p)
+  until #r >= 7
+  assert(table.concat(r, ",") ==
+         "tableX,tableX,tableX,table0,table1,table2,tablefloat")
+  out(table.concat(r, ","))
+end
+
+
+-- temporaries between lookups, in several statements of a loop
+do
+  local s = 0
+  for i = 1, 10 do
+    s = s + math.max(i, 5) + string.len(string.rep("a", i))
+  end
+  assert(s == 65 + 55)
+  out(s)
+end
+
+
+-- globals assigned by functions called in the loop
+do
+  G1 = 1
+  local function bump () G1 = G1 + 1 end
+  local r = {}
+  for i = 1, 4 do
+    r[i] = G1
+    bump()
+  end
+  assert(table.concat(r, ",") == "1,2,3,4")
+  out(table.concat(r, ","))
+  -- a global that only appears in the middle of the loop
+  G2 = nil
+  r = {}
+  for i = 1, 4 do
+    r[i] = tostring(G2)
+    if i == 2 then G2 = "here" end
+  end
+  assert(table.concat(r, ",") == "nil,nil,here,here")
+  out(table.concat(r, ","))
+  G1, G2 = nil
+end
+
+
+-- fields of modules changed during the loop
+do
+  local M = {f = function () return 1 end}
+  GM = M
+  local function change (i)
+    if i == 2 then M.f = function () return 2 end
+    elseif i == 3 then rawset(M, "f", function () return 3 end)
+    elseif i == 4 then M.f = nil
+    end
+  end
+  local r = {}
+  for i = 1, 5 do
+    local f = GM.f
+    r[i] = f and f() or "none"
+    change(i)
+  end
+  assert(table.concat(r, ",") == "1,1,2,3,none")
+  out(table.concat(r, ","))
+  -- the module itself replaced
+  GM = {f = function () return "a" end}
+  r = {}
+  for i = 1, 3 do
+    r[i] = GM.f()
+    if i == 1 then GM = {f = function () return "b" end} end
+  end
+  assert(table.concat(r, ",") == "a,b,b")
+  out(table.concat(r, ","))
+  -- cleared
+  GM = {f = print}
+  r = {}
+  for i = 1, 3 do
+    r[i] = tostring(GM.f == print)
+    table.clear(GM)
+  end
+  assert(table.concat(r, ",") == "true,false,false")
+  out(table.concat(r, ","))
+  GM = nil
+end
+
+
+-- lookups that go through '__index'
+do
+  local proto = {v = 1}
+  GO = setmetatable({}, {__index = proto})
+  local r = {}
+  for i = 1, 6 do
+    r[i] = GO.v
+    if i == 2 then proto.v = 2
+    elseif i == 3 then setmetatable(GO, {__index = {v = 3}})
+    elseif i == 4 then rawset(GO, "v", 4)
+    elseif i == 5 then GO.v = nil; setmetatable(GO, nil)
+    end
+  end
+  assert(table.concat(r, ",", 1, 5) == "1,1,2,3,4" and r[6] == nil)
+  out(table.concat(r, ",", 1, 5), r[6])
+  -- a global environment with a metatable
+  local mt = {__index = function (_, k) return "mt:" .. k end}
+  local f = load([[
+    local r = {}
+    for i = 1, 3 do
+      r[i] = tostring(NOSUCH)
+      if i == 1 then setmetatable(_ENV, ...) end
+      if i == 2 then NOSUCH = "set" end
+    end
+    NOSUCH = nil; setmetatable(_ENV, nil)
+    return table.concat(r, ",")
+  ]])
+  local res = f(mt)
+  assert(res == "nil,mt:NOSUCH,set", res)
+  out(res)
+  GO = nil
+end
+
+
+-- '_ENV' and other upvalues
+do
+  local env1 = {x = 1, tostring = tostring}
+  local env2 = {x = 2, tostring = tostring}
+  -- a function whose '_ENV' upvalue is changed from outside
+  local f = load([[
+    local r = {}
+    for i = 1, 4 do
+      r[i] = tostring(x)
+      coroutine.yield()
+    end
+    return r
+  ]], "f", "t", env1)
+  env1.coroutine = coroutine
+  env2.coroutine = coroutine
+  local co = coroutine.wrap(f)
+  co(); co()
+  debug.setupvalue(f, 1, env2)
+  co()
+  env2.x = 3
+  co()
+  local r = co()
+  assert(table.concat(r, ",") == "1,1,2,3", table.concat(r, ","))
+  out(table.concat(r, ","))
+  -- '_ENV' assigned by the loop itself
+  local g = load([[
+    local e1, e2 = ...
+    local r = {}
+    for i = 1, 4 do
+      local tostring = tostring
+      r[i] = tostring(x)
+      _ENV = (i % 2 == 1) and e2 or e1
+    end
+    return r
+  ]], "g", "t", env1)
+  r = g(env1, env2)
+  assert(table.concat(r, ",") == "1,3,1,3")
+  out(table.concat(r, ","))
+  -- a closed upvalue holding a table, assigned by another closure
+  local function make ()
+    local t = {v = 1}
+    local function set (v) t = {v = v} end
+    local function loop (n)
+      local r = {}
+      for i = 1, n do
+        r[i] = t.v
+        set(i + 1)
+      end
+      return r
+    end
+    return loop, set
+  end
+  local loop = make()
+  r = loop(4)
+  assert(table.concat(r, ",") == "1,2,3,4")
+  out(table.concat(r, ","))
+  -- upvalues joined during the loop
+  local function mk (v)
+    local u = {v = v}
+    return function (join)
+      local r = {}
+      for i = 1, 3 do
+        r[i] = u.v
+        if i == 1 then join() end
+      end
+      return r
+    end
+  end
+  local loopa, loopb = mk("a"), mk("b")
+  r = loopa(function () debug.upvaluejoin(loopa, 1, loopb, 1) end)
+  assert(table.concat(r, ",") == "a,b,b")
+  out(table.concat(r, ","))
+end
+
+
+-- keys assigned in the loop itself
+do
+  local t = {}
+  GK = {n = 0}
+  for i = 1, 5 do
+    t[i] = GK.n
+    GK.n = GK.n + 1
+  end
+  assert(table.concat(t, ",") == "0,1,2,3,4")
+  out(table.concat(t, ","))
+  GK = nil
+end
+
+
+-- values of other types in intermediate tables
+do
+  local r = {}
+  local vals = {"str", {v = 3}, 10}
+  GW = {inner = {v = 1}}
+  for i = 1, 4 do
+    if type(GW.inner) == "number" then
+      r[i] = "number"
+    else
+      r[i] = tostring(GW.inner.v)  -- (strings index 'string')
+    end
+    GW.inner = vals[i]
+  end
+  assert(table.concat(r, ",") == "1,nil,3,number")
+  out(table.concat(r, ","))
+  GW = nil
+end
+
+
+print "OK"
+
+return table.concat(log, "\n")
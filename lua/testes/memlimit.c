@@ -0,0 +1,203 @@
+/*
+** $Id: memlimit.c $
+** Tests for the memory limits (lua_setmemlimit, lua_setmemlimitf)
+** See Copyright Notice in lua.h
+**
+** Build it with the Lua library, e.g., from this directory,
+**   cc -O2 -I.. -o memlimit memlimit.c ../l*.c -lm
+** and run it with no arguments; it prints "OK" when all tests pass.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define KB	((size_t)1024)
+#define MB	(1024 * KB)
+
+
+/* allocation function that keeps the peak of the memory in use */
+typedef struct Mem {
+  size_t total;
+  size_t peak;
+} Mem;
+
+
+static void *countalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Mem *m = (Mem *)ud;
+  if (ptr == NULL) osize = 0;
+  if (nsize == 0) {
+    free(ptr);
+    m->total -= osize;
+    return NULL;
+  }
+  ptr = realloc(ptr, nsize);
+  if (ptr != NULL) {
+    m->total += nsize - osize;
+    if (m->total > m->peak) m->peak = m->total;
+  }
+  return ptr;
+}
+
+
+static lua_State *newstate (Mem *m) {
+  lua_State *L;
+  m->total = m->peak = 0;
+  L = lua_newstate(countalloc, m);
+  assert(L != NULL);
+  luaL_openlibs(L);
+  return L;
+}
+
+
+/* bytes in use, as seen by Lua */
+static size_t inuse (lua_State *L) {
+  return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * KB +
+         (size_t)lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+
+/* run 'code'; return its status */
+static int run (lua_State *L, const char *code) {
+  int status = luaL_loadstring(L, code);
+  if (status == LUA_OK)
+    status = lua_pcall(L, 0, 0, 0);
+  lua_settop(L, 0);
+  return status;
+}
+
+
+/* keeps 'n' MB of strings alive */
+#define KEEP(n)	"t = {} for i = 1, " #n " * 1024 do " \
+		"t[i] = string.rep('x', 1000) .. i end"
+
+/* makes 'n' MB of garbage */
+#define GARBAGE(n)	"for i = 1, " #n " * 1024 do " \
+			"local s = string.rep('y', 1000) .. i end"
+
+
+static void testsetget (void) {
+  Mem m;
+  lua_State *L = newstate(&m);
+  assert(lua_setmemlimit(L, LUA_MEMHARD, 100 * MB) == 0);  /* no limit */
+  assert(lua_setmemlimit(L, LUA_MEMHARD, 200 * MB) == 100 * MB);
+  assert(lua_setmemlimit(L, LUA_MEMSOFT, 50 * MB) == 0);
+  assert(lua_setmemlimit(L, LUA_MEMSOFT, 0) == 50 * MB);
+  assert(lua_setmemlimit(L, LUA_MEMHARD, 0) == 200 * MB);
+  lua_close(L);
+}
+
+
+static void testhard (void) {
+  Mem m;
+  lua_State *L = newstate(&m);
+  size_t limit = inuse(L) + 2 * MB;
+  lua_setmemlimit(L, LUA_MEMHARD, limit);
+  /* garbage fits: emergency collections free it */
+  assert(run(L, GARBAGE(20)) == LUA_OK);
+  assert(m.peak <= limit + 64 * KB);  /* (and a block that failed) */
+  /* live data does not */
+  assert(run(L, KEEP(10)) == LUA_ERRMEM);
+  assert(inuse(L) <= limit);
+  /* the state is still usable */
+  assert(run(L, "t = nil; collectgarbage(); x = string.rep('a', 100)") ==
+         LUA_OK);
+  /* without the limit, the same code works */
+  lua_setmemlimit(L, LUA_MEMHARD, 0);
+  assert(run(L, KEEP(10)) == LUA_OK);
+  assert(inuse(L) > 10 * MB);
+  lua_close(L);
+}
+
+
+static void testsoft (void) {
+  Mem m;
+  lua_State *L = newstate(&m);
+  size_t base;
+  /* with some live data, a lazy collector lets garbage pile up */
+  assert(run(L, "keep = {} for i = 1, 5 * 1024 do "
+                "keep[i] = string.rep('k', 1000) .. i end") == LUA_OK);
+  lua_gc(L, LUA_GCSETPAUSE, 1000);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  base = inuse(L);
+  m.peak = 0;
+  assert(run(L, GARBAGE(40)) == LUA_OK);
+  assert(m.peak > base + 20 * MB);
+  /* above the soft limit, it works harder */
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  lua_setmemlimit(L, LUA_MEMSOFT, base + 2 * MB);
+  m.peak = 0;
+  assert(run(L, GARBAGE(40)) == LUA_OK);
+  assert(m.peak < base + 8 * MB);
+  /* it is only a soft limit: live data can go above it */
+  assert(run(L, KEEP(5)) == LUA_OK);
+  assert(inuse(L) > base + 5 * MB);
+  lua_close(L);
+}
+
+
+/* limit function: raises the hard limit a few times, then gives up */
+typedef struct Calls {
+  int soft, hard;
+  int raises;  /* how many times to raise the hard limit */
+} Calls;
+
+
+static size_t onlimit (void *ud, lua_State *L, int what, size_t total,
+                       size_t limit) {
+  Calls *c = (Calls *)ud;
+  (void)L;
+  assert(total > limit);
+  if (what == LUA_MEMSOFT) {
+    c->soft++;
+    return limit;
+  }
+  assert(what == LUA_MEMHARD);
+  c->hard++;
+  if (c->raises-- > 0)
+    return limit + 4 * MB;
+  return limit;
+}
+
+
+static void testlimitf (void) {
+  Mem m;
+  Calls c = {0, 0, 2};
+  lua_State *L = newstate(&m);
+  size_t limit = inuse(L) + 2 * MB;
+  lua_setmemlimitf(L, onlimit, &c);
+  lua_setmemlimit(L, LUA_MEMHARD, limit);
+  /* 7 MB fit in the limit raised twice */
+  assert(run(L, KEEP(7)) == LUA_OK);
+  assert(c.hard == 2);
+  assert(lua_setmemlimit(L, LUA_MEMHARD, limit) == limit + 8 * MB);
+  /* no more raises */
+  assert(run(L, "t = nil; collectgarbage();" KEEP(7)) == LUA_ERRMEM);
+  assert(c.hard == 3);
+  /* the soft limit asks the function too */
+  lua_setmemlimit(L, LUA_MEMHARD, 0);
+  lua_setmemlimit(L, LUA_MEMSOFT, inuse(L) + MB);
+  assert(run(L, GARBAGE(10)) == LUA_OK);
+  assert(c.soft > 0);
+  /* removing the function */
+  lua_setmemlimitf(L, NULL, NULL);
+  c.soft = 0;
+  assert(run(L, GARBAGE(10)) == LUA_OK);
+  assert(c.soft == 0);
+  lua_close(L);
+}
+
+
+int main (void) {
+  testsetget();
+  testhard();
+  testsoft();
+  testlimitf();
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,174 @@
+-- $Id: optimize.lua $
+-- Tests for the propagation of constant locals (LUA_COPTCONST). Run it
+-- with 'lua optimize.lua' under any compiler options, or with 'hoist'
+-- (see hoist.c), which runs it under all of them and compares the
+-- results. Checks of the optimized code itself run only when the pass
+-- is on.
+
+print "testing constant propagation"
+
+local log = {}
+
+-- records a result (which must be the same under all options)
+local function out (...)
+  local t = table.pack(...)
+  for i = 1, t.n do t[i] = tostring(t[i]) end
+  log[#log + 1] = table.concat(t, " ")
+end
+
+
+-- the optimized code does not see changes made through 'debug'
+local CONST
+do
+  local K = 2
+  local function probe () return K end
+  debug.setupvalue(probe, 1, 3)
+  CONST = (probe() == 2)
+end
+print("(constant propagation " .. (CONST and "on)" or "off)"))
+
+
+-- number of instructions executed by a call to 'f'
+local function count (f)
+  local n = 0
+  debug.sethook(function () n = n + 1 end, "", 1)
+  f()
+  debug.sethook()
+  return n
+end
+
+
+-- constant folding
+do
+  local A, B = 6, 7
+  local S = "x"
+  local function f () return A * B + 1, S .. A, -A, A // 4, A < B end
+  out(f())
+  local r = {f()}
+  assert(r[1] == 43 and r[2] == "x6" and r[3] == -6 and r[4] == 1 and r[5])
+  -- folded operations run fewer instructions
+  local function g ()
+    local x = A * B + 1
+    local y = x - 3
+    return y * 2
+  end
+  local function h (a, b)
+    local x = a * b + 1
+    local y = x - 3
+    return y * 2
+  end
+  assert(g() == 80 and h(A, B) == 80)
+  out(g(), h(A, B))
+  if CONST then
+    assert(count(g) < count(function () return h(A, B) end) - 1)
+    -- upvalues that capture constant locals are constants too
+    debug.setupvalue(f, 1, 0)
+    assert(f() == 43)
+  end
+  -- folding keeps the results of the virtual machine
+  local I, F, Z = math.maxinteger, 2.0, 0
+  local function k ()
+    return I + 1, F ^ 2, 7 // F, I // -1, 3 % -2, 1 / Z, -Z
+  end
+  out(k())
+  assert(math.type(k()) == "integer" and select(2, k()) == 4.0)
+  -- divisions by zero and NaN are not folded
+  local function z () return I // Z end
+  out(pcall(z))
+  assert(not pcall(z))
+  local function nan () return 0/Z ~= 0/Z end
+  assert(nan())
+end
+
+
+-- locals that change are not constants
+do
+  local a = 1
+  local function get () return a end
+  local function set (v) a = v end
+  set(10)
+  assert(get() == 10)
+  local b = 1
+  for i = 1, 3 do b = b + i end
+  assert(b == 7)
+  local c = 1
+  if get() == 10 then c = 2 end
+  assert(c == 2)
+  out(get(), b, c)
+end
+
+
+-- code under false constant conditions is removed
+do
+  local f = load[[
+local DEBUG = false
+local TRACE = true
+return function (x)
+  if DEBUG then
+    error("debugging")
+  end
+  if not TRACE then
+    error("not tracing")
+  end
+  while DEBUG do x = x + 1 end
+  return x
+end]]()
+  assert(f(3) == 3)
+  out(f(3))
+  local lines = debug.getinfo(f, "L").activelines
+  assert(lines[11] and lines[12])  -- return and end
+  if CONST then
+    for l = 4, 10 do assert(not lines[l], l) end
+  else
+    assert(lines[4] and lines[5] and lines[7])
+  end
+end
+
+
+-- error messages name the variables of operands
+do
+  local FL = 1.5
+  local S = "abc"
+  local B = true
+  local N = 7
+  local function msg (f)
+    local ok, m = pcall(f)
+    assert(not ok)
+    out(m)
+    return m
+  end
+  assert(string.find(msg(function () return FL | 1 end), "upvalue 'FL'"))
+  assert(string.find(msg(function () return ~FL end), "upvalue 'FL'"))
+  assert(string.find(msg(function () return -S end), "upvalue 'S'"))
+  assert(string.find(msg(function () return S + 1 end), "upvalue 'S'"))
+  assert(string.find(msg(function () return B .. "x" end), "upvalue 'B'"))
+  assert(string.find(msg(function () return N() end), "upvalue 'N'"))
+  assert(string.find(msg(function () return N.x end), "upvalue 'N'"))
+  assert(string.find(msg(function () return #N end), "upvalue 'N'"))
+  assert(string.find(msg(function () local x = FL | 1; return x end),
+                     "upvalue 'FL'"))
+  assert(string.find(msg(function () local z = B; return z .. "q" end),
+                     "local 'z'"))
+  assert(string.find(msg(function () return FL | 1 end), "upvalue 'FL'"))
+  do
+    local b = FL
+    assert(string.find(msg(function () return b | 1 end), "upvalue 'b'"))
+  end
+  -- in nested functions
+  local function outer ()
+    return function () return S * 2 end
+  end
+  assert(string.find(msg(outer()), "upvalue 'S'"))
+  -- and in the function that declares the constant
+  assert(string.find(msg(function ()
+    local L = "abc"
+    return L + 1
+  end), "local 'L'"))
+  -- valid uses still fold
+  assert(FL + 1 == 2.5 and S .. N == "abc7" and -N == -7)
+end
+
+
+print "OK"
+
+return table.concat(log, "\n")
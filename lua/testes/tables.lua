@@ -0,0 +1,267 @@
+-- $Id: tables.lua $
+-- Tests for the table library extensions (run with 'lua tables.lua')
+
+print "testing table.new, table.reserve and table.clear"
+
+local maxi = math.maxinteger
+
+-- count entries with 'next'
+local function count (t)
+  local n = 0
+  for _ in pairs(t) do n = n + 1 end
+  return n
+end
+
+
+-- table.new
+do
+  local t = table.new()
+  assert(type(t) == "table" and next(t) == nil and #t == 0)
+  t = table.new(100, 50)
+  assert(next(t) == nil and #t == 0)
+  for i = 1, 100 do t[i] = i * 2 end
+  for i = 1, 50 do t["k" .. i] = i end
+  assert(#t == 100 and count(t) == 150)
+  for i = 1, 100 do assert(t[i] == i * 2) end
+  for i = 1, 50 do assert(t["k" .. i] == i) end
+  -- sizes are only hints
+  t = table.new(0, 2)
+  for i = 1, 1000 do t[i] = true; t[-i] = true end
+  assert(count(t) == 2000)
+  t = table.new(3)
+  t.x = 1; t[1] = 1; t[2.5] = 2
+  assert(count(t) == 3)
+  -- invalid sizes
+  assert(not pcall(table.new, -1))
+  assert(not pcall(table.new, 0, -1))
+  assert(not pcall(table.new, maxi))
+  assert(not pcall(table.new, "x"))
+  assert(string.find(select(2, pcall(table.new, -1)), "invalid size"))
+end
+
+
+-- presized arrays of numbers are packed (8 bytes per element, instead
+-- of 16)
+do
+  local N = 100000
+  local function size (f)
+    collectgarbage(); collectgarbage()
+    local base = collectgarbage("count")
+    local t = f()
+    collectgarbage(); collectgarbage()
+    return (collectgarbage("count") - base) * 1024 / N, t
+  end
+  local s, t = size(function ()
+    local t = table.new(N)
+    for i = 1, N do t[i] = i end
+    return t
+  end)
+  assert(s < 12 and #t == N and t[N] == N)
+  s, t = size(function ()
+    local t = table.new(N)
+    for i = 1, N do t[i] = i + 0.5 end
+    return t
+  end)
+  assert(s < 12 and t[N] == N + 0.5)
+  local f = load("return {" .. string.rep("7,", N) .. "}")
+  s, t = size(f)
+  assert(s < 12 and #t == N and t[1] == 7 and t[N] == 7)
+  s = size(function ()
+    local t = table.new(N)
+    for i = 1, N do t[i] = "" end
+    return t
+  end)
+  assert(s > 12)
+  -- packed arrays still take any value
+  t = table.new(20)
+  t[1] = 1; t[3] = 3; t[2] = 2.5; t[4] = "x"
+  assert(t[1] == 1 and t[2] == 2.5 and t[3] == 3 and t[4] == "x" and #t == 4)
+  t = table.new(10)
+  for i = 10, 1, -1 do t[i] = i end
+  for i = 1, 10 do assert(t[i] == i) end
+  table.insert(t, 11)
+  assert(#t == 11 and t[11] == 11)
+  t = table.new(10)
+  t[1] = 1; t[1] = nil; t[1] = 2; t[2] = {}
+  assert(t[1] == 2 and type(t[2]) == "table" and count(t) == 2)
+  t = {1, 2, 3, 4, 5, 6, 7, 8, 9, "x"}
+  assert(#t == 10 and t[9] == 9 and t[10] == "x")
+end
+
+
+-- table.reserve
+do
+  local t = {10, 20, 30, x = 1, y = 2}
+  assert(table.reserve(t, 1000, 100) == t)
+  assert(#t == 3 and t[3] == 30 and t.x == 1 and t.y == 2)
+  assert(count(t) == 5)
+  for i = 4, 1000 do t[i] = i end
+  for i = 1, 100 do t["f" .. i] = i end
+  assert(#t == 1000 and count(t) == 1102)
+  -- reserving less than what is in use keeps all entries
+  assert(table.reserve(t, 0, 0) == t)
+  assert(#t == 1000 and count(t) == 1102)
+  for i = 4, 1000 do assert(t[i] == i) end
+  -- sizes are optional
+  assert(table.reserve(t) == t and count(t) == 1102)
+  -- arrays of numbers only, and arrays that stop being so
+  t = {}
+  for i = 1, 10 do t[i] = i + 0.5 end
+  table.reserve(t, 100)
+  for i = 11, 100 do t[i] = i + 0.5 end
+  t[50] = "x"
+  assert(#t == 100 and t[50] == "x" and t[51] == 51.5)
+  -- the table keeps its metatable and contents are still raw
+  local mt = {__index = function () return "dflt" end}
+  t = setmetatable({1}, mt)
+  table.reserve(t, 10, 10)
+  assert(getmetatable(t) == mt and t[1] == 1 and t[2] == "dflt")
+  -- invalid arguments
+  assert(not pcall(table.reserve, 1, 10))
+  assert(not pcall(table.reserve, {}, -1))
+  assert(not pcall(table.reserve, {}, 0, -1))
+  assert(not pcall(table.reserve, {}, maxi))
+end
+
+
+-- table.clear
+do
+  local mt = {}
+  local t = setmetatable({}, mt)
+  for i = 1, 100 do t[i] = i end
+  for i = 1, 100 do t["k" .. i] = i; t[i + 0.5] = i end
+  assert(table.clear(t) == nil)
+  assert(next(t) == nil and #t == 0 and t[1] == nil and t.k1 == nil)
+  assert(getmetatable(t) == mt)
+  -- the table can be filled again, with other keys
+  for i = 1, 200 do t["z" .. i] = i end
+  t[1] = 1
+  assert(count(t) == 201 and #t == 1 and t.z200 == 200)
+  table.clear(t)
+  assert(next(t) == nil)
+  -- arrays of numbers only
+  t = {1, 2, 3, 4.5}
+  table.clear(t)
+  assert(#t == 0 and next(t) == nil)
+  t[1] = "a"
+  assert(#t == 1 and t[1] == "a")
+  -- empty tables
+  t = {}
+  table.clear(t)
+  assert(next(t) == nil)
+  -- tables that are being resized
+  t = {}
+  for i = 1, 100000 do t["x" .. i] = i end
+  table.clear(t)
+  assert(next(t) == nil and t.x1 == nil and t.x100000 == nil)
+  for i = 1, 1000 do t["x" .. i] = -i end
+  assert(count(t) == 1000 and t.x1000 == -1000)
+  -- values no longer in the table can be collected
+  local weak = setmetatable({}, {__mode = "k"})
+  t = {}
+  local k = {}
+  t[k] = {}
+  weak[k] = true; weak[t[k]] = true
+  k = nil
+  table.clear(t)
+  collectgarbage()
+  assert(next(weak) == nil)
+  assert(not pcall(table.clear, 1))
+  assert(not pcall(table.clear))
+end
+
+
+print "testing table.clone"
+
+-- check that 'c' has the same entries as 't'
+local function same (t, c)
+  assert(t ~= c)
+  for k, v in pairs(t) do assert(rawequal(rawget(c, k), v)) end
+  for k, v in pairs(c) do assert(rawequal(rawget(t, k), v)) end
+end
+
+
+-- shallow copies
+do
+  same({}, table.clone({}))
+  local t = {1, 2, 3, nil, 5, x = "x", [2.5] = true, [{}] = 0}
+  local c = table.clone(t)
+  same(t, c)
+  -- the copy is independent of the original
+  c[1] = 10; c.x = nil; c.y = 1
+  assert(t[1] == 1 and t.x == "x" and t.y == nil)
+  t[2] = 20
+  assert(c[2] == 2)
+  -- values are not copied
+  local sub = {}
+  t = {sub, k = sub}
+  c = table.clone(t)
+  assert(c[1] == sub and c.k == sub)
+  -- the copy gets the same metatable
+  local mt = {__index = function () return "dflt" end}
+  t = setmetatable({a = 1}, mt)
+  c = table.clone(t)
+  assert(getmetatable(c) == mt and c.a == 1 and c.b == "dflt")
+  -- arrays of numbers only
+  t = {}
+  for i = 1, 100 do t[i] = i * 0.5 end
+  c = table.clone(t)
+  same(t, c)
+  assert(#c == 100)
+  c[50] = "x"
+  assert(t[50] == 25.0 and c[51] == 25.5)
+  -- tables that are being resized
+  t = {}
+  for i = 1, 100000 do t["k" .. i] = i end
+  c = table.clone(t)
+  same(t, c)
+  c.k1 = nil
+  for i = 1, 1000 do c["n" .. i] = i end
+  assert(t.k1 == 1 and t.n1 == nil)
+  -- weak tables stay weak
+  t = setmetatable({}, {__mode = "k"})
+  t[{}] = 1
+  c = table.clone(t)
+  collectgarbage()
+  assert(next(t) == nil and next(c) == nil)
+  assert(not pcall(table.clone, 1))
+  assert(not pcall(table.clone))
+end
+
+
+-- deep copies
+do
+  local shared = {s = 1}
+  local key = {}
+  local t = {a = {b = {c = 1}}, shared, shared, [key] = {2}}
+  t.self = t
+  local mt = {}
+  t.m = setmetatable({}, mt)
+  local c = table.clone(t, true)
+  assert(c ~= t and c.a ~= t.a and c.a.b ~= t.a.b and c.a.b.c == 1)
+  -- shape is kept: cycles and shared tables
+  assert(c.self == c)
+  assert(c[1] == c[2] and c[1] ~= shared and c[1].s == 1)
+  -- keys and metatables are not cloned
+  assert(c[key] ~= t[key] and c[key][1] == 2)
+  assert(getmetatable(c.m) == mt and c.m ~= t.m)
+  -- copies are independent
+  c.a.b.c = 2
+  assert(t.a.b.c == 1)
+  -- a false second argument gives a shallow copy
+  c = table.clone(t, false)
+  assert(c.a == t.a and c.self == t)
+  -- deep structures (no limit on depth)
+  local l = {}
+  for i = 1, 100000 do l = {next = l} end
+  c = table.clone(l, true)
+  local n = 0
+  while c.next do
+    assert(c ~= l)
+    c, l = c.next, l.next
+    n = n + 1
+  end
+  assert(n == 100000)
+end
+
+print "OK"